@@ -0,0 +1,168 @@
+/*
+ * Compares the hand-written template parser against the mpc grammar it replaced,
+ * by parsing every template in tests/data (or the directories given as arguments) repeatedly.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <err.h>
+
+#include "vendor/mpc.h"
+#include "parser.h"
+
+#define ITERATIONS 2000
+
+/* the grammar parser_init() used before templates were parsed by src/parser.c */
+static mpc_parser_t *mpc_parser_init() {
+    mpc_parser_t *spaces = mpc_new("spaces");
+    mpc_parser_t *symbol = mpc_new("symbol");
+    mpc_parser_t *number = mpc_new("number");
+    mpc_parser_t *string = mpc_new("string");
+    mpc_parser_t *text = mpc_new("text");
+    mpc_parser_t *print = mpc_new("print");
+    mpc_parser_t *lexp = mpc_new("lexp");
+    mpc_parser_t *exp = mpc_new("expression");
+    mpc_parser_t *comment = mpc_new("comment");
+    mpc_parser_t *statement = mpc_new("statement");
+    mpc_parser_t *statement_open = mpc_new("statement_open");
+    mpc_parser_t *statement_close = mpc_new("statement_close");
+    mpc_parser_t *statement_for = mpc_new("for");
+    mpc_parser_t *statement_if = mpc_new("if");
+    mpc_parser_t *statement_block = mpc_new("block");
+    mpc_parser_t *statement_extends = mpc_new("extends");
+    mpc_parser_t *body = mpc_new("body");
+    mpc_parser_t *content = mpc_new("content");
+    mpc_parser_t *factor = mpc_new("factor");
+    mpc_parser_t *term = mpc_new("term");
+    mpc_parser_t *filter = mpc_new("filter");
+    mpc_parser_t *template = mpc_new("template");
+
+    mpca_lang(MPCA_LANG_WHITESPACE_SENSITIVE,
+        " spaces    : / */ ;"
+        " symbol    : /[a-zA-Z][a-zA-Z0-9_.]*/ ;"
+        " number    : /[0-9]+/ ;"
+        " text      : /[^{][^{%#]*/;"
+        " string    : '\"' /([^\"])*/ '\"' ;"
+        " factor    : <symbol> | <number> | <string> ;"
+        " filter    : <spaces> '|' <spaces> <symbol>; "
+        " term      :  <factor> (<spaces> ('*' | '/' | '%') <spaces> <factor>)* <filter>?;"
+        " lexp      : <term> (<spaces> ('+' | '-') <spaces> <term>)* ;"
+        " expression: <lexp> <spaces> '>' <spaces> <lexp> "
+        "           | <lexp> <spaces> '<' <spaces> <lexp> "
+        "           | <lexp> <spaces> \">=\" <spaces> <lexp> "
+        "           | <lexp> <spaces> \"<=\" <spaces> <lexp> "
+        "           | <lexp> <spaces> \"!=\" <spaces> <lexp> "
+        "           | <lexp> <spaces> \"==\" <spaces> <lexp> "
+        "           | \"not\" <spaces> <lexp> "
+        "           | <lexp> ;"
+        " print     : /{{2}-? */ <expression> / *-?}}/ ;"
+        " comment   : \"{#\" /[^#][^#}]*/ \"#}\" ;"
+        " statement_open: /{\%-? */;"
+        " statement_close: / *-?\%}/;"
+        " for       : <statement_open> \"for \" <symbol> \" in \" <symbol> <statement_close> <body> <statement_open> \"endfor\" <statement_close> ;"
+        " block     : <statement_open> \"block \" <symbol> <statement_close> <body> <statement_open> \"endblock\" <statement_close>;"
+        " extends   : <statement_open> \"extends \" <string> <statement_close>;"
+        " if        : <statement_open> \"if \" <expression> <statement_close> <body> (<statement_open> \"else\" <statement_close> <body>)? <statement_open> \"endif\" <statement_close> ;"
+        " statement : <for> | <block> | <extends> | <if> ;"
+        " content   : <print> | <statement> | <text> | <comment>;"
+        " body      : <content>* ;"
+        " template  : /^/ <body> /$/ ;",
+        spaces, filter, factor, term, symbol, text, number, string, print, lexp, exp, comment,
+        statement_open, statement_close, statement, statement_if, statement_for, statement_block,
+        statement_extends, content, body, template);
+
+    return template;
+}
+
+static char *slurp(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        err(EXIT_FAILURE, "could not open \"%s\"", filename);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *input = malloc(size + 1);
+    if (fread(input, 1, size, f) != (size_t) size) {
+        errx(EXIT_FAILURE, "could not read \"%s\"", filename);
+    }
+    input[size] = '\0';
+    fclose(f);
+    return input;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_file(mpc_parser_t *grammar, const char *filename) {
+    char *input = slurp(filename);
+
+    double start = now();
+    for (int i=0; i < ITERATIONS; i++) {
+        mpc_result_t r;
+        if (!mpc_parse(filename, input, grammar, &r)) {
+            mpc_err_print(r.error);
+            exit(EXIT_FAILURE);
+        }
+        mpc_ast_delete(r.output);
+    }
+    double mpc_ns = (now() - start) / ITERATIONS;
+
+    start = now();
+    for (int i=0; i < ITERATIONS; i++) {
+        struct parse_error error;
+        struct ast *ast = parse(input, &error);
+        if (!ast) {
+            errx(EXIT_FAILURE, "%s:%d:%d: %s", filename, error.line, error.col, error.message);
+        }
+        ast_free(ast);
+    }
+    double parser_ns = (now() - start) / ITERATIONS;
+
+    printf("%-50s %6zu bytes %10.0f ns/op (mpc) %8.0f ns/op (parser) %6.1fx\n", filename, strlen(input), mpc_ns, parser_ns, mpc_ns / parser_ns);
+    free(input);
+}
+
+static void bench_dir(mpc_parser_t *grammar, const char *dirname) {
+    DIR *dr = opendir(dirname);
+    if (dr == NULL) {
+        errx(EXIT_FAILURE, "could not open directory \"%s\"", dirname);
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dr)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+
+        char path[512];
+        snprintf(path, sizeof path, "%s/%s", dirname, de->d_name);
+        DIR *sub = opendir(path);
+        if (sub) {
+            closedir(sub);
+            bench_dir(grammar, path);
+        } else {
+            bench_file(grammar, path);
+        }
+    }
+
+    closedir(dr);
+}
+
+int main(int argc, char **argv) {
+    mpc_parser_t *grammar = mpc_parser_init();
+    if (argc < 2) {
+        bench_dir(grammar, "tests/data");
+    }
+    for (int i=1; i < argc; i++) {
+        bench_dir(grammar, argv[i]);
+    }
+    return 0;
+}
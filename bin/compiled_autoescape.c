@@ -0,0 +1,64 @@
+/* generated by unja-compile from tests/data/autoescape, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+static char strings_0[] = "<p title=\"\000title\000\">\000body\000</p>\n"
+        "\000html\000safe\000\n"
+        "\000body\000e\000\n"
+        "\000count\000\n"
+        "\000";
+
+static struct segment segments_0[] = {
+    { 11, 5, 275622439u, 1 },
+    { 20, 4, 2090119731u, 1 },
+    { 31, 4, 2090341082u, 1 },
+    { 43, 4, 2090119731u, 1 },
+    { 52, 5, 255678574u, 1 },
+};
+
+static struct program program_0 = {
+    .strings = strings_0,
+    .strings_size = 60,
+    .segments = segments_0,
+    .segments_size = 5,
+};
+
+/* page.tmpl */
+static void render_0(struct compiled_render *r) {
+    struct unja_object s0;
+
+    compiled_text(r, "<p title=\"", 10, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "\">", 2, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 1);
+    compiled_print(r, &s0);
+    compiled_text(r, "</p>\n", 5, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 2);
+    filter_safe(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "\n", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 3);
+    filter_escape(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "\n", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 4);
+    compiled_print(r, &s0);
+    compiled_text(r, "\n", 1, 0);
+}
+
+static const struct compiled_template templates[] = {
+    { "page.tmpl", render_0 },
+};
+
+/* render a template compiled from tests/data/autoescape, or from env (which may be NULL) if it is not one of them */
+char *autoescape(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 1, 1, env, template_name, vars);
+}
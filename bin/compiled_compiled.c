@@ -0,0 +1,250 @@
+/* generated by unja-compile from tests/data/compiled, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+/* layout.tmpl */
+static void render_0(struct compiled_render *r) {
+    compiled_text(r, "<title>", 7, 0);
+    compiled_set_trim(r, 0);
+    /* block title */
+    compiled_text(r, "</title>\n", 9, 1);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n", 1, 1);
+}
+
+static char strings_1[] = "layout.tmpl\000\n"
+        "\n"
+        "\000title\000title\000trim\000 (\000title\000length\000)\000\n"
+        "\n"
+        "\000content\000\n"
+        "\000title\000no title\000title\000wordcount\000 words\000\n"
+        "<ul>\000\000items\000item\000\n"
+        "    <li class=\"\000first\000last\000\">\000. \000item\000lower\000</li>\n"
+        "\000\n"
+        "</ul>\n"
+        "\000title\000trim\000lower\000truncate\000 \000title\000e\000 \000user\000name\000 \000user\000email\000 \000user\000name\000Danny\000 \000 \000a b c\000wordcount\000\n"
+        "\000title\000length\000i\000i\000i\000i\000 \000price\000price\000 more\000price\000 expensive\000 negative\000\n"
+        "\000user\000missing\000missing\000\"quoted\" \\backslash?\? \000\000\n"
+        "\000\n"
+        "\000<title>\000title\000</title>\n"
+        "\000content\000\n"
+        "\000";
+
+static struct segment segments_1[] = {
+    { 21, 5, 275622439u, 1 },
+    { 35, 5, 275622439u, 1 },
+    { 63, 5, 275622439u, 1 },
+    { 78, 5, 275622439u, 1 },
+    { 108, 5, 262956327u, 1 },
+    { 153, 4, 2090376756u, 1 },
+    { 179, 5, 275622439u, 1 },
+    { 207, 5, 275622439u, 1 },
+    { 217, 4, 2090806916u, 0 },
+    { 222, 4, 2090536006u, 1 },
+    { 229, 4, 2090806916u, 0 },
+    { 234, 5, 257956589u, 1 },
+    { 242, 4, 2090806916u, 0 },
+    { 247, 4, 2090536006u, 1 },
+    { 280, 5, 275622439u, 1 },
+    { 295, 1, 177678u, 1 },
+    { 299, 1, 177678u, 1 },
+    { 303, 5, 271189912u, 1 },
+    { 309, 5, 271189912u, 1 },
+    { 321, 5, 271189912u, 1 },
+    { 350, 4, 2090806916u, 0 },
+    { 355, 7, 3348825183u, 1 },
+};
+
+static struct program program_1 = {
+    .strings = strings_1,
+    .strings_size = 433,
+    .segments = segments_1,
+    .segments_size = 22,
+};
+
+/* page.tmpl */
+static void render_1(struct compiled_render *r) {
+    struct unja_object s0, s1;
+
+    compiled_text(r, "<title>", 7, 0);
+    compiled_set_trim(r, 0);
+    /* block title */
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 0);
+    filter_trim(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, " (", 2, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 1);
+    filter_length(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, ")", 1, 0);
+    compiled_text(r, "</title>\n", 9, 1);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n", 1, 0);
+    s0 = compiled_load(r, &program_1, 2);
+    s0 = make_int_object(!object_to_int(&s0));
+    if (s0.integer <= 0) goto L23;
+    compiled_text(r, "no title", 8, 1);
+    compiled_set_trim(r, 0);
+    goto L29;
+L23:
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 3);
+    filter_wordcount(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, " words", 6, 0);
+    compiled_set_trim(r, 0);
+L29:
+    compiled_text(r, "\n"
+        "<ul>", 5, 0);
+    if (!compiled_for_begin(r, &program_1, 4, strings_1 + 114)) goto L53;
+L31:
+    compiled_text(r, "\n"
+        "    <li class=\"", 16, 1);
+    s0 = make_int_object(compiled_loop_field(r, 1));
+    if (s0.integer <= 0) goto L36;
+    compiled_text(r, "first", 5, 1);
+    compiled_set_trim(r, 0);
+L36:
+    s0 = make_int_object(compiled_loop_field(r, 2));
+    if (s0.integer <= 0) goto L40;
+    compiled_text(r, "last", 4, 1);
+    compiled_set_trim(r, 0);
+L40:
+    compiled_text(r, "\">", 2, 0);
+    compiled_set_trim(r, 0);
+    s0 = make_int_object(compiled_loop_field(r, 0));
+    s1 = make_int_object(1);
+    s0 = make_int_object(s0.integer + s1.integer);
+    compiled_print(r, &s0);
+    compiled_text(r, ". ", 2, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load_local(r, &program_1, 5, 0);
+    filter_lower(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "</li>\n", 6, 0);
+    if (compiled_for_next(r)) goto L31;
+L53:
+    compiled_rtrim(r);
+    compiled_text(r, "\n"
+        "</ul>\n", 7, 1);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 6);
+    filter_trim(compiled_arena(r), &s0, NULL, 0);
+    filter_lower(compiled_arena(r), &s0, NULL, 0);
+    s1 = make_int_object(8);
+    filter_truncate(compiled_arena(r), &s0, (struct unja_object[]) { s1 }, 1);
+    compiled_print(r, &s0);
+    compiled_text(r, " ", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 7);
+    filter_escape(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, " ", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 8);
+    s1 = make_string_view(" ", 1);
+    compiled_binary(r, &s0, OP_ADD, &s1);
+    s1 = compiled_load(r, &program_1, 10);
+    compiled_binary(r, &s0, OP_ADD, &s1);
+    compiled_print(r, &s0);
+    compiled_text(r, " ", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 12);
+    s1 = make_string_view("Danny", 5);
+    compiled_binary(r, &s0, OP_EQ, &s1);
+    compiled_print(r, &s0);
+    compiled_text(r, " ", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = make_int_object(7);
+    s1 = make_int_object(6);
+    s0 = make_int_object(s0.integer * s1.integer);
+    s1 = make_int_object(5);
+    s0 = make_int_object(s0.integer % s1.integer);
+    s1 = make_int_object(1);
+    s0 = make_int_object(s0.integer - s1.integer);
+    compiled_print(r, &s0);
+    compiled_text(r, " ", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = make_string_view("a b c", 5);
+    filter_wordcount(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "\n", 1, 0);
+    s0 = compiled_load(r, &program_1, 14);
+    filter_length(compiled_arena(r), &s0, NULL, 0);
+    if (!compiled_for_range(r, s0.integer, strings_1 + 293)) goto L104;
+L100:
+    compiled_set_trim(r, 0);
+    s0 = compiled_load_local(r, &program_1, 15, 0);
+    compiled_print(r, &s0);
+    if (compiled_for_next(r)) goto L100;
+L104:
+    compiled_set_trim(r, 0);
+    s0 = make_int_object(2);
+    if (!compiled_for_range(r, s0.integer, strings_1 + 297)) goto L115;
+L107:
+    compiled_set_trim(r, 0);
+    s0 = make_int_object(compiled_loop_field(r, 2));
+    if (s0.integer <= 0) goto L114;
+    compiled_set_trim(r, 0);
+    s0 = compiled_load_local(r, &program_1, 16, 0);
+    compiled_print(r, &s0);
+    compiled_set_trim(r, 0);
+L114:
+    if (compiled_for_next(r)) goto L107;
+L115:
+    compiled_text(r, " ", 1, 1);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 17);
+    s1 = make_int_object(2);
+    compiled_binary(r, &s0, OP_MUL, &s1);
+    compiled_print(r, &s0);
+    s0 = compiled_load(r, &program_1, 18);
+    s1 = make_int_object(9);
+    compiled_binary(r, &s0, OP_SUB, &s1);
+    if (!object_is_truthy(&s0)) goto L127;
+    compiled_text(r, " more", 5, 1);
+    compiled_set_trim(r, 0);
+L127:
+    s0 = compiled_load(r, &program_1, 19);
+    s1 = make_int_object(9);
+    compiled_binary(r, &s0, OP_GT, &s1);
+    if (s0.integer <= 0) goto L133;
+    compiled_text(r, " expensive", 10, 1);
+    compiled_set_trim(r, 0);
+L133:
+    s0 = make_int_object(1);
+    s1 = make_int_object(2);
+    s0 = make_int_object(s0.integer - s1.integer);
+    if (s0.integer <= 0) goto L139;
+    compiled_text(r, " negative", 9, 1);
+    compiled_set_trim(r, 0);
+L139:
+    compiled_text(r, "\n", 1, 0);
+    s0 = compiled_load(r, &program_1, 20);
+    if (!object_is_truthy(&s0)) goto L144;
+    compiled_text(r, "missing", 7, 1);
+    compiled_set_trim(r, 0);
+L144:
+    compiled_text(r, "\"quoted\" \\backslash?\? ", 22, 0);
+    compiled_set_trim(r, 0);
+    s0 = make_string_view("", 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "\n", 1, 0);
+    compiled_text(r, "\n", 1, 1);
+}
+
+static const struct compiled_template templates[] = {
+    { "layout.tmpl", render_0 },
+    { "page.tmpl", render_1 },
+};
+
+/* render a template compiled from tests/data/compiled, or from env (which may be NULL) if it is not one of them */
+char *compiled(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 2, 0, env, template_name, vars);
+}
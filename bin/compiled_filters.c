@@ -0,0 +1,61 @@
+/* generated by unja-compile from tests/data/filters, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+static char strings_0[] = "name\000repeat\000|\000name\000lower\000repeat\000truncate\000|\000name\000x\000repeat\000length\000\n"
+        "\000";
+
+static struct segment segments_0[] = {
+    { 0, 4, 2090536006u, 1 },
+    { 14, 4, 2090536006u, 1 },
+    { 43, 4, 2090536006u, 1 },
+};
+
+static struct program program_0 = {
+    .strings = strings_0,
+    .strings_size = 66,
+    .segments = segments_0,
+    .segments_size = 3,
+};
+
+/* page.tmpl */
+static void render_0(struct compiled_render *r) {
+    struct unja_object s0, s1, s2;
+    const struct unja_filter *f0 = compiled_find_filter(r, "repeat");
+
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 0);
+    s1 = make_int_object(3);
+    compiled_filter(r, "repeat", f0, &s0, (struct unja_object[]) { s1 }, 1);
+    compiled_print(r, &s0);
+    compiled_text(r, "|", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 1);
+    filter_lower(compiled_arena(r), &s0, NULL, 0);
+    s1 = make_int_object(1);
+    s2 = make_int_object(1);
+    s1 = make_int_object(s1.integer + s2.integer);
+    compiled_filter(r, "repeat", f0, &s0, (struct unja_object[]) { s1 }, 1);
+    s1 = make_int_object(8);
+    filter_truncate(compiled_arena(r), &s0, (struct unja_object[]) { s1 }, 1);
+    compiled_print(r, &s0);
+    compiled_text(r, "|", 1, 0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 2);
+    s1 = make_string_view("x", 1);
+    compiled_filter(r, "repeat", f0, &s0, (struct unja_object[]) { s1 }, 1);
+    filter_length(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "\n", 1, 0);
+}
+
+static const struct compiled_template templates[] = {
+    { "page.tmpl", render_0 },
+};
+
+/* render a template compiled from tests/data/filters, or from env (which may be NULL) if it is not one of them */
+char *filters(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 1, 0, env, template_name, vars);
+}
@@ -0,0 +1,47 @@
+/* generated by unja-compile from tests/data/inheritance-depth-1, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+/* base.tmpl */
+static void render_0(struct compiled_render *r) {
+    compiled_text(r, "Header", 6, 0);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n"
+        "Content \n", 10, 0);
+    compiled_text(r, "\n"
+        "\n", 2, 1);
+    compiled_rtrim(r);
+    compiled_set_trim(r, 0);
+    /* block footer */
+    compiled_text(r, "\n"
+        "Footer\n", 8, 0);
+    compiled_set_trim(r, 1);
+}
+
+/* one.tmpl */
+static void render_1(struct compiled_render *r) {
+    compiled_text(r, "Header", 6, 0);
+    compiled_set_trim(r, 0);
+    compiled_text(r, "\n"
+        "Child content\n", 15, 0);
+    compiled_text(r, "\n"
+        "\n", 2, 1);
+    compiled_rtrim(r);
+    compiled_set_trim(r, 0);
+    compiled_text(r, "\n"
+        "Footer\n", 8, 0);
+    compiled_set_trim(r, 1);
+}
+
+static const struct compiled_template templates[] = {
+    { "base.tmpl", render_0 },
+    { "one.tmpl", render_1 },
+};
+
+/* render a template compiled from tests/data/inheritance-depth-1, or from env (which may be NULL) if it is not one of them */
+char *inheritance_depth_1(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 2, env, template_name, vars);
+}
@@ -0,0 +1,67 @@
+/* generated by unja-compile from tests/data/inheritance-depth-2, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+/* base.tmpl */
+static void render_0(struct compiled_render *r) {
+    compiled_text(r, "0", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n"
+        "0 \n", 4, 0);
+    compiled_text(r, "\n"
+        "\n", 2, 1);
+    compiled_rtrim(r);
+    compiled_set_trim(r, 0);
+    /* block footer */
+    compiled_text(r, "\n"
+        "0\n", 3, 0);
+    compiled_set_trim(r, 1);
+}
+
+/* one.tmpl */
+static void render_1(struct compiled_render *r) {
+    compiled_text(r, "0", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n"
+        "1\n", 3, 0);
+    compiled_text(r, "\n"
+        "\n", 2, 1);
+    compiled_rtrim(r);
+    compiled_set_trim(r, 0);
+    /* block footer */
+    compiled_text(r, "\n"
+        "1\n", 3, 0);
+    compiled_set_trim(r, 1);
+}
+
+/* two.tmpl */
+static void render_2(struct compiled_render *r) {
+    compiled_text(r, "0", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n"
+        "1\n", 3, 0);
+    compiled_text(r, "\n"
+        "\n", 2, 1);
+    compiled_rtrim(r);
+    compiled_set_trim(r, 0);
+    /* block footer */
+    compiled_text(r, "\n"
+        "2\n", 3, 0);
+    compiled_set_trim(r, 1);
+}
+
+static const struct compiled_template templates[] = {
+    { "base.tmpl", render_0 },
+    { "one.tmpl", render_1 },
+    { "two.tmpl", render_2 },
+};
+
+/* render a template compiled from tests/data/inheritance-depth-2, or from env (which may be NULL) if it is not one of them */
+char *inheritance_depth_2(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 3, 0, env, template_name, vars);
+}
@@ -0,0 +1,175 @@
+/* generated by unja-compile from tests/data/inheritance-nested, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+/* base.tmpl */
+static void render_0(struct compiled_render *r) {
+    compiled_text(r, "<", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block outer */
+    compiled_text(r, "[", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block inner */
+    compiled_text(r, "base", 4, 0);
+    compiled_text(r, "]", 1, 1);
+    compiled_text(r, ">", 1, 1);
+}
+
+static char strings_1[] = "base.tmpl\000items\000i\000inner\000i\000<\000outer\000[\000inner\000base\000]\000>\000";
+
+static struct segment segments_1[] = {
+    { 10, 5, 262956327u, 1 },
+    { 24, 1, 177678u, 1 },
+};
+
+static struct program program_1 = {
+    .strings = strings_1,
+    .strings_size = 51,
+    .segments = segments_1,
+    .segments_size = 2,
+};
+
+/* four.tmpl */
+static void render_1(struct compiled_render *r) {
+    struct unja_object s0;
+
+    compiled_text(r, "<", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block outer */
+    compiled_text(r, "[", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block inner */
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_1, 1);
+    compiled_print(r, &s0);
+    compiled_text(r, "]", 1, 1);
+    compiled_text(r, ">", 1, 1);
+}
+
+static char strings_2[] = "base.tmpl\000outer\000items\000i\000(\000inner\000one\000)\000<\000outer\000[\000inner\000base\000]\000>\000";
+
+static struct segment segments_2[] = {
+    { 16, 5, 262956327u, 1 },
+};
+
+static struct program program_2 = {
+    .strings = strings_2,
+    .strings_size = 63,
+    .segments = segments_2,
+    .segments_size = 1,
+};
+
+/* one.tmpl */
+static void render_2(struct compiled_render *r) {
+    compiled_text(r, "<", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block outer */
+    if (!compiled_for_begin(r, &program_2, 0, strings_2 + 22)) goto L10;
+L4:
+    compiled_text(r, "(", 1, 1);
+    compiled_set_trim(r, 0);
+    /* block inner */
+    compiled_text(r, "one", 3, 0);
+    compiled_text(r, ")", 1, 1);
+    if (compiled_for_next(r)) goto L4;
+L10:
+    compiled_set_trim(r, 0);
+    compiled_text(r, ">", 1, 1);
+}
+
+static char strings_3[] = "one.tmpl\000inner\000loop\000index\000i\000base.tmpl\000outer\000items\000i\000(\000inner\000one\000)\000<\000outer\000[\000inner\000base\000]\000>\000";
+
+static struct segment segments_3[] = {
+    { 15, 4, 2090479455u, 0 },
+    { 20, 5, 262739357u, 1 },
+    { 26, 1, 177678u, 1 },
+    { 44, 5, 262956327u, 1 },
+};
+
+static struct program program_3 = {
+    .strings = strings_3,
+    .strings_size = 91,
+    .segments = segments_3,
+    .segments_size = 4,
+};
+
+/* three.tmpl */
+static void render_3(struct compiled_render *r) {
+    struct unja_object s0;
+
+    compiled_text(r, "<", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block outer */
+    if (!compiled_for_begin(r, &program_3, 3, strings_3 + 50)) goto L15;
+L4:
+    compiled_text(r, "(", 1, 1);
+    compiled_set_trim(r, 0);
+    /* block inner */
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_3, 0);
+    compiled_print(r, &s0);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_3, 2);
+    compiled_print(r, &s0);
+    compiled_text(r, ")", 1, 1);
+    if (compiled_for_next(r)) goto L4;
+L15:
+    compiled_set_trim(r, 0);
+    compiled_text(r, ">", 1, 1);
+}
+
+static char strings_4[] = "one.tmpl\000inner\000two\000none\000base.tmpl\000outer\000items\000i\000(\000inner\000one\000)\000<\000outer\000[\000inner\000base\000]\000>\000";
+
+static struct segment segments_4[] = {
+    { 40, 5, 262956327u, 1 },
+};
+
+static struct program program_4 = {
+    .strings = strings_4,
+    .strings_size = 87,
+    .segments = segments_4,
+    .segments_size = 1,
+};
+
+/* two.tmpl */
+static void render_4(struct compiled_render *r) {
+    struct unja_object s0;
+
+    compiled_text(r, "<", 1, 0);
+    compiled_set_trim(r, 0);
+    /* block outer */
+    if (!compiled_for_begin(r, &program_4, 0, strings_4 + 46)) goto L16;
+L4:
+    compiled_text(r, "(", 1, 1);
+    compiled_set_trim(r, 0);
+    /* block inner */
+    s0 = make_int_object(1);
+    if (s0.integer <= 0) goto L12;
+    compiled_text(r, "two", 3, 1);
+    compiled_set_trim(r, 0);
+    goto L14;
+L12:
+    compiled_text(r, "none", 4, 1);
+    compiled_set_trim(r, 0);
+L14:
+    compiled_text(r, ")", 1, 1);
+    if (compiled_for_next(r)) goto L4;
+L16:
+    compiled_set_trim(r, 0);
+    compiled_text(r, ">", 1, 1);
+}
+
+static const struct compiled_template templates[] = {
+    { "base.tmpl", render_0 },
+    { "four.tmpl", render_1 },
+    { "one.tmpl", render_2 },
+    { "three.tmpl", render_3 },
+    { "two.tmpl", render_4 },
+};
+
+/* render a template compiled from tests/data/inheritance-nested, or from env (which may be NULL) if it is not one of them */
+char *inheritance_nested(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 5, 0, env, template_name, vars);
+}
@@ -0,0 +1,32 @@
+/* generated by unja-compile from tests/data/recursive, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+/* base.tmpl */
+static void render_0(struct compiled_render *r) {
+    compiled_text(r, "Hello ", 6, 0);
+    compiled_set_trim(r, 0);
+    /* block name */
+    compiled_text(r, "nobody", 6, 0);
+    compiled_text(r, "!", 1, 1);
+}
+
+/* emails/welcome.tmpl */
+static void render_1(struct compiled_render *r) {
+    compiled_text(r, "Hello ", 6, 0);
+    compiled_set_trim(r, 0);
+    compiled_text(r, "world", 5, 0);
+    compiled_text(r, "!", 1, 1);
+}
+
+static const struct compiled_template templates[] = {
+    { "base.tmpl", render_0 },
+    { "emails/welcome.tmpl", render_1 },
+};
+
+/* render a template compiled from tests/data/recursive, or from env (which may be NULL) if it is not one of them */
+char *recursive(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 2, env, template_name, vars);
+}
@@ -0,0 +1,52 @@
+/* generated by unja-compile from tests/data/streaming, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+static char strings_0[] = "<ul>\000\000items\000item\000\n"
+        "    <li>\000item\000</li>\n"
+        "\000\n"
+        "</ul>\n"
+        "\000";
+
+static struct segment segments_0[] = {
+    { 6, 5, 262956327u, 1 },
+    { 27, 4, 2090376756u, 1 },
+};
+
+static struct program program_0 = {
+    .strings = strings_0,
+    .strings_size = 47,
+    .segments = segments_0,
+    .segments_size = 2,
+};
+
+/* list.tmpl */
+static void render_0(struct compiled_render *r) {
+    struct unja_object s0;
+
+    compiled_text(r, "<ul>", 4, 0);
+    if (!compiled_for_begin(r, &program_0, 0, strings_0 + 12)) goto L8;
+L2:
+    compiled_text(r, "\n"
+        "    <li>", 9, 1);
+    compiled_set_trim(r, 0);
+    s0 = compiled_load(r, &program_0, 1);
+    compiled_print(r, &s0);
+    compiled_text(r, "</li>\n", 6, 0);
+    if (compiled_for_next(r)) goto L2;
+L8:
+    compiled_rtrim(r);
+    compiled_text(r, "\n"
+        "</ul>\n", 7, 1);
+}
+
+static const struct compiled_template templates[] = {
+    { "list.tmpl", render_0 },
+};
+
+/* render a template compiled from tests/data/streaming, or from env (which may be NULL) if it is not one of them */
+char *streaming(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 1, env, template_name, vars);
+}
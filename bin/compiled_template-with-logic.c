@@ -0,0 +1,69 @@
+/* generated by unja-compile from tests/data/template-with-logic, do not edit */
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+/* base.tmpl */
+static void render_0(struct compiled_render *r) {
+    compiled_text(r, "Header", 6, 0);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n"
+        "Content \n", 10, 0);
+    compiled_text(r, "\n"
+        "\n", 2, 1);
+    compiled_rtrim(r);
+    compiled_set_trim(r, 0);
+    /* block footer */
+    compiled_text(r, "\n"
+        "Footer\n", 8, 0);
+    compiled_set_trim(r, 1);
+}
+
+/* child.tmpl */
+static void render_1(struct compiled_render *r) {
+    struct unja_object s0, s1;
+
+    compiled_text(r, "Header", 6, 0);
+    compiled_set_trim(r, 0);
+    /* block content */
+    compiled_text(r, "\n"
+        "\t", 2, 0);
+    compiled_set_trim(r, 0);
+    s0 = make_string_view("Hello World", 11);
+    filter_lower(compiled_arena(r), &s0, NULL, 0);
+    compiled_print(r, &s0);
+    compiled_text(r, "\n"
+        "\t", 2, 0);
+    s0 = make_int_object(2);
+    s1 = make_int_object(1);
+    s0 = make_int_object(s0.integer < s1.integer);
+    if (s0.integer <= 0) goto L16;
+    compiled_text(r, "2 is less than 1.", 17, 1);
+    compiled_set_trim(r, 1);
+    goto L18;
+L16:
+    compiled_text(r, "2 is more than 1.", 17, 1);
+    compiled_set_trim(r, 0);
+L18:
+    compiled_text(r, "\n", 1, 0);
+    compiled_text(r, "\n"
+        "\n", 2, 1);
+    compiled_rtrim(r);
+    compiled_set_trim(r, 0);
+    /* block footer */
+    compiled_text(r, "\n"
+        "Footer\n", 8, 0);
+    compiled_set_trim(r, 1);
+}
+
+static const struct compiled_template templates[] = {
+    { "base.tmpl", render_0 },
+    { "child.tmpl", render_1 },
+};
+
+/* render a template compiled from tests/data/template-with-logic, or from env (which may be NULL) if it is not one of them */
+char *template_with_logic(struct env *env, char *template_name, struct hashmap *vars) {
+    return compiled_render_template(templates, 2, 0, env, template_name, vars);
+}
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <err.h>
+#include "arena.h"
+#include "stats.h"
+
+/* alignment suitable for any object we allocate */
+#define ARENA_ALIGN (2 * sizeof(void *))
+
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t size;
+    size_t cap;
+    char data[];
+};
+
+static struct arena_chunk *chunk_new(size_t cap, struct arena_chunk *prev) {
+    struct arena_chunk *chunk = malloc(sizeof *chunk + cap);
+    if (!chunk) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    count_alloc(sizeof *chunk + cap);
+    chunk->prev = prev;
+    chunk->size = 0;
+    chunk->cap = cap;
+    return chunk;
+}
+
+/* allocate a new arena with an initial capacity of cap bytes */
+struct arena *arena_new(size_t cap) {
+    struct arena *a = malloc(sizeof *a);
+    if (!a) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    count_alloc(sizeof *a);
+    a->chunk = chunk_new(cap, NULL);
+    a->nchunks = 1;
+    a->allocations = 0;
+    a->bytes = 0;
+    return a;
+}
+
+/* allocate size bytes, growing the arena by a new chunk at least twice as big as the last one if needed */
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    a->allocations++;
+    a->bytes += size;
+
+    struct arena_chunk *chunk = a->chunk;
+    if (chunk->cap - chunk->size < size) {
+        size_t cap = chunk->cap * 2;
+        while (cap < size) {
+            cap *= 2;
+        }
+        chunk = a->chunk = chunk_new(cap, chunk);
+        a->nchunks++;
+    }
+
+    void *ptr = chunk->data + chunk->size;
+    chunk->size += size;
+    return ptr;
+}
+
+/* release all allocations. an arena that grew is replaced by a single chunk of its total size, 
+   so that the next round of the same allocations does not need to grow again. */
+void arena_reset(struct arena *a) {
+    a->allocations = 0;
+    a->bytes = 0;
+    if (a->nchunks == 1) {
+        a->chunk->size = 0;
+        return;
+    }
+
+    size_t cap = 0;
+    struct arena_chunk *chunk = a->chunk;
+    while (chunk) {
+        struct arena_chunk *prev = chunk->prev;
+        cap += chunk->cap;
+        free(chunk);
+        chunk = prev;
+    }
+
+    a->chunk = chunk_new(cap, NULL);
+    a->nchunks = 1;
+}
+
+void arena_free(struct arena *a) {
+    struct arena_chunk *chunk = a->chunk;
+    while (chunk) {
+        struct arena_chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    free(a);
+}
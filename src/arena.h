@@ -0,0 +1,16 @@
+#include <stdlib.h>
+
+/* bump allocator: allocations are only released all at once, by resetting or freeing the arena */
+struct arena {
+    struct arena_chunk *chunk;
+    int nchunks;
+
+    /* number of allocations and bytes allocated since the arena was created or last reset */
+    size_t allocations;
+    size_t bytes;
+};
+
+struct arena *arena_new(size_t cap);
+void *arena_alloc(struct arena *a, size_t size);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "hashmap.h"
+#include "program.h"
+
+#define CACHE_MAGIC "UNJACACH"
+
+/* bump whenever the instruction set or the layout of the file changes */
+#define CACHE_VERSION 6
+
+/* sections are aligned so that instructions, positions and segments can be used in place */
+#define CACHE_ALIGN 8
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+
+    /* sizes of the types stored in the file, so a file written by a different build is never used */
+    uint32_t abi;
+    uint64_t checksum;
+    uint64_t size;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/* offsets are relative to the start of the file. names are NUL-terminated. */
+struct cache_entry {
+    uint64_t name;
+    uint64_t code;
+    uint64_t positions;
+    uint64_t strings;
+    uint64_t segments;
+    uint64_t blocks;
+    int64_t mtime_ns;
+    int64_t size;
+    int32_t code_size;
+    int32_t strings_size;
+    int32_t segments_size;
+    int32_t nblocks;
+
+    /* offset of the parent name in the string pool, or -1 */
+    int32_t parent;
+};
+
+struct cache_block {
+    int32_t name;
+    int32_t start;
+    int32_t end;
+};
+
+struct cache {
+    char *data;
+    size_t size;
+
+    /* entries by template name */
+    struct hashmap *index;
+};
+
+static uint32_t cache_abi() {
+    return (uint32_t) (sizeof(struct instr) << 16 | sizeof(struct segment) << 8 | sizeof(struct cache_entry));
+}
+
+/* FNV-1a, taking 8 bytes at a time as the whole file is checked on every start */
+static uint64_t checksum(const char *data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    for (; i < size; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* map a cache file, returns NULL if it does not exist or can not be used */
+struct cache *cache_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct cache_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct cache_header *header = (struct cache_header *) data;
+    size_t size = st.st_size;
+    if (memcmp(header->magic, CACHE_MAGIC, 8) != 0
+        || header->version != CACHE_VERSION
+        || header->abi != cache_abi()
+        || header->size != size
+        || header->count > (size - sizeof *header) / sizeof(struct cache_entry)
+        || header->checksum != checksum(data + sizeof *header, size - sizeof *header)) {
+        munmap(data, size);
+        return NULL;
+    }
+
+    struct cache *cache = malloc(sizeof *cache);
+    if (!cache) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    cache->data = data;
+    cache->size = size;
+    cache->index = hashmap_new_with_cap(header->count);
+    struct cache_entry *entries = (struct cache_entry *) (data + sizeof *header);
+    for (uint32_t i=0; i < header->count; i++) {
+        hashmap_insert(cache->index, data + entries[i].name, &entries[i]);
+    }
+    return cache;
+}
+
+/* 
+ * Returns the program of a template, if the cache holds it for a source of the given modification time and size.
+ * Its instructions, positions, strings and segments point into the cache, which has to outlive it.
+ */
+struct program *cache_get(struct cache *cache, const char *name, int64_t mtime_ns, int64_t size) {
+    struct cache_entry *e = hashmap_get(cache->index, (char *) name);
+    if (e == NULL || e->mtime_ns != mtime_ns || e->size != size) {
+        return NULL;
+    }
+
+    struct program *prog = malloc(sizeof *prog);
+    if (!prog) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    prog->mapped = 1;
+    prog->code = (struct instr *) (cache->data + e->code);
+    prog->size = prog->cap = e->code_size;
+    prog->positions = (struct source_pos *) (cache->data + e->positions);
+    prog->strings = cache->data + e->strings;
+    prog->strings_size = prog->strings_cap = e->strings_size;
+    prog->segments = (struct segment *) (cache->data + e->segments);
+    prog->segments_size = prog->segments_cap = e->segments_size;
+    prog->parent = e->parent >= 0 ? prog->strings + e->parent : NULL;
+
+    struct cache_block *blocks = (struct cache_block *) (cache->data + e->blocks);
+    prog->blocks = hashmap_new_with_cap(e->nblocks);
+    for (int i=0; i < e->nblocks; i++) {
+        struct block *b = malloc(sizeof *b);
+        if (!b) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+        b->start = blocks[i].start;
+        b->end = blocks[i].end;
+        hashmap_insert(prog->blocks, prog->strings + blocks[i].name, b);
+    }
+
+    return prog;
+}
+
+/* cache file being built in memory */
+struct writer {
+    char *data;
+    size_t size;
+    size_t cap;
+};
+
+/* append size bytes (zeroes if data is NULL), aligned. returns the offset they were written at */
+static uint64_t put(struct writer *w, const void *data, size_t size) {
+    size_t offset = (w->size + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+    if (offset + size > w->cap) {
+        while (offset + size > w->cap) {
+            w->cap *= 2;
+        }
+        w->data = realloc(w->data, w->cap);
+        if (!w->data) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    memset(w->data + w->size, 0, offset - w->size);
+    if (data) {
+        memcpy(w->data + offset, data, size);
+    } else {
+        memset(w->data + offset, 0, size);
+    }
+    w->size = offset + size;
+    return offset;
+}
+
+/* write programs to a cache file, replacing it atomically. returns 0 on success, -1 on error */
+int cache_write(const char *path, struct cache_item *items, int n) {
+    struct writer w;
+    w.cap = 4096;
+    w.size = 0;
+    w.data = malloc(w.cap);
+    if (!w.data) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+
+    /* header and entries are filled in once all offsets are known */
+    put(&w, NULL, sizeof(struct cache_header));
+    uint64_t entries = put(&w, NULL, n * sizeof(struct cache_entry));
+
+    for (int i=0; i < n; i++) {
+        struct program *prog = items[i].program;
+        struct cache_entry e;
+        e.mtime_ns = items[i].mtime_ns;
+        e.size = items[i].size;
+        e.name = put(&w, items[i].name, strlen(items[i].name) + 1);
+        e.code_size = prog->size;
+        e.code = put(&w, prog->code, prog->size * sizeof *prog->code);
+        e.positions = put(&w, prog->positions, prog->size * sizeof *prog->positions);
+        e.strings_size = prog->strings_size;
+        e.strings = put(&w, prog->strings, prog->strings_size);
+        e.segments_size = prog->segments_size;
+        e.segments = put(&w, prog->segments, prog->segments_size * sizeof *prog->segments);
+        e.parent = prog->parent ? prog->parent - prog->strings : -1;
+
+        e.nblocks = 0;
+        e.blocks = put(&w, NULL, 0);
+        for (size_t j=0; j < prog->blocks->cap; j++) {
+            struct hashmap_entry *entry = &prog->blocks->entries[j];
+            if (entry->key == NULL) {
+                continue;
+            }
+
+            struct block *b = entry->value;
+            struct cache_block block = { entry->key - prog->strings, b->start, b->end };
+            put(&w, &block, sizeof block);
+            e.nblocks++;
+        }
+
+        memcpy(w.data + entries + i * sizeof e, &e, sizeof e);
+    }
+
+    struct cache_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = CACHE_VERSION;
+    header.abi = cache_abi();
+    header.checksum = checksum(w.data + sizeof header, w.size - sizeof header);
+    header.size = w.size;
+    header.count = n;
+    memcpy(w.data, &header, sizeof header);
+
+    /* write to a temporary file first, so processes opening the cache never see a partial one */
+    char *tmp = malloc(strlen(path) + 32);
+    if (!tmp) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    sprintf(tmp, "%s.%ld", path, (long) getpid());
+    FILE *f = fopen(tmp, "wb");
+    int error = f == NULL;
+    if (f) {
+        error |= fwrite(w.data, 1, w.size, f) != w.size;
+        error |= fclose(f) != 0;
+    }
+    free(w.data);
+
+    if (error || rename(tmp, path) != 0) {
+        remove(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    free(tmp);
+    return 0;
+}
+
+void cache_close(struct cache *cache) {
+    hashmap_free(cache->index);
+    munmap(cache->data, cache->size);
+    free(cache);
+}
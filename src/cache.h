@@ -0,0 +1,21 @@
+/*
+ * File of compiled templates, which is mapped into memory and used without deserialising.
+ * Programs are stored with the modification time (in nanoseconds) and size of their source, so stale ones are not used.
+ */
+#include <stdint.h>
+
+struct program;
+struct cache;
+
+/* template to store in a cache file */
+struct cache_item {
+    const char *name;
+    int64_t mtime_ns;
+    int64_t size;
+    struct program *program;
+};
+
+struct cache *cache_open(const char *path);
+struct program *cache_get(struct cache *cache, const char *name, int64_t mtime_ns, int64_t size);
+int cache_write(const char *path, struct cache_item *items, int n);
+void cache_close(struct cache *cache);
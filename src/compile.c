@@ -0,0 +1,735 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+
+#include "hashmap.h"
+#include "parser.h"
+#include "program.h"
+
+struct compiler {
+    struct program *prog;
+    const char *source;
+
+    /* highest instruction index that is the target of a jump, used to guard peephole optimisations */
+    int barrier;
+
+    /* pool offsets of block names and their positions, turned into a hashmap once the pool stops moving */
+    struct {
+        int name;
+        int start;
+        int end;
+    } *blocks;
+    int nblocks;
+    int parent;
+
+    /* source line of the node being compiled */
+    int line;
+
+    /* variables of the enclosing loops, innermost last. only loops from scope_base on are resolved at compile time,
+       as a block may be inlined into a different loop than the one it is in */
+    struct {
+        int pos;
+        int len;
+    } *scope;
+    int scope_size;
+    int scope_cap;
+    int scope_base;
+
+    /* number of filters applied so far, which number the next one */
+    int filters;
+};
+
+/* copy a string of length l into the program's string pool, returns its offset */
+static int intern(struct program *prog, const char *str, int l) {
+    if (prog->strings_size + l + 1 > prog->strings_cap) {
+        while (prog->strings_size + l + 1 > prog->strings_cap) {
+            prog->strings_cap *= 2;
+        }
+        prog->strings = realloc(prog->strings, prog->strings_cap);
+        if (!prog->strings) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    int offset = prog->strings_size;
+    memcpy(prog->strings + offset, str, l);
+    prog->strings[offset + l] = '\0';
+    prog->strings_size += l + 1;
+    return offset;
+}
+
+static int append(struct program *prog, struct instr ins, struct source_pos pos) {
+    if (prog->size == prog->cap) {
+        prog->cap *= 2;
+        prog->code = realloc(prog->code, prog->cap * sizeof *prog->code);
+        prog->positions = realloc(prog->positions, prog->cap * sizeof *prog->positions);
+        if (!prog->code || !prog->positions) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    prog->code[prog->size] = ins;
+    prog->positions[prog->size] = pos;
+    return prog->size++;
+}
+
+static int emit(struct compiler *c, enum opcode op, int a, int b, int d) {
+    struct instr ins = { .op = op, .a = a, .b = b, .c = d };
+    struct source_pos pos = { -1, c->line };
+    return append(c->prog, ins, pos);
+}
+
+/* returns the index of the next instruction, marking it as a jump target */
+static int label(struct compiler *c) {
+    c->barrier = c->prog->size;
+    return c->prog->size;
+}
+
+static struct instr *last_instr(struct compiler *c) {
+    if (c->prog->size == 0 || c->barrier == c->prog->size) {
+        return NULL;
+    }
+
+    return &c->prog->code[c->prog->size - 1];
+}
+
+static void emit_text(struct compiler *c, const char *str, int l) {
+    struct program *prog = c->prog;
+    struct instr *prev = last_instr(c);
+    int trimmed = 0;
+
+    /* a preceding SET_TRIM only ever affects this text, so apply it now */
+    if (prev && prev->op == OP_SET_TRIM) {
+        if (prev->a) {
+            while (l > 0 && isspace(*str)) {
+                str++;
+                l--;
+            }
+        }
+        prog->size--;
+        prev = last_instr(c);
+        trimmed = 1;
+    }
+
+    if (l == 0) {
+        if (trimmed) {
+            emit(c, OP_SET_TRIM, 0, 0, 0);
+        }
+        return;
+    }
+
+    /* a preceding text consumed any pending trim, so this text can be appended to it
+       as long as that text does not consist of whitespace only (which the trim could eat entirely) */
+    if (prev && prev->op == OP_TEXT && prev->a + prev->b + 1 == prog->strings_size) {
+        int has_content = prev->c;
+        for (int i = 0; i < prev->b && !has_content; i++) {
+            has_content = !isspace(prog->strings[prev->a + i]);
+        }
+
+        if (has_content) {
+            prog->strings_size--;
+            intern(prog, str, l);
+            prev->b += l;
+            return;
+        }
+    }
+
+    int offset = intern(prog, str, l);
+    emit(c, OP_TEXT, offset, l, trimmed);
+}
+
+static void emit_rtrim(struct compiler *c) {
+    struct program *prog = c->prog;
+    struct instr *prev = last_instr(c);
+
+    /* trim a directly preceding text at compile time, unless it would become empty */
+    if (prev && prev->op == OP_TEXT) {
+        int l = prev->b;
+        while (l > 0 && isspace(prog->strings[prev->a + l - 1])) {
+            l--;
+        }
+
+        if (l > 0) {
+            prog->strings[prev->a + l] = '\0';
+            prev->b = l;
+            return;
+        }
+    }
+
+    emit(c, OP_RTRIM, 0, 0, 0);
+}
+
+static void emit_set_trim(struct compiler *c, int trim) {
+    struct instr *prev = last_instr(c);
+    if (prev && prev->op == OP_SET_TRIM) {
+        c->prog->size--;
+    }
+
+    emit(c, OP_SET_TRIM, trim != 0, 0, 0);
+}
+
+static void patch(struct compiler *c, int pos, int target) {
+    enum opcode op = c->prog->code[pos].op;
+    if (op == OP_FOR_BEGIN || op == OP_FOR_RANGE || op == OP_BLOCK) {
+        c->prog->code[pos].c = target;
+    } else {
+        c->prog->code[pos].a = target;
+    }
+}
+
+static enum opcode binary_opcodes[] = {
+    [BIN_ADD] = OP_ADD,
+    [BIN_SUB] = OP_SUB,
+    [BIN_MUL] = OP_MUL,
+    [BIN_DIV] = OP_DIV,
+    [BIN_MOD] = OP_MOD,
+    [BIN_GT] = OP_GT,
+    [BIN_GTE] = OP_GTE,
+    [BIN_LT] = OP_LT,
+    [BIN_LTE] = OP_LTE,
+    [BIN_EQ] = OP_EQ,
+    [BIN_NEQ] = OP_NEQ,
+};
+
+static int intern_node(struct compiler *c, struct node *node) {
+    return intern(c->prog, c->source + node->pos, node->len);
+}
+
+/* split a (dotted) symbol into segments, returns the index of the first one */
+static int intern_path(struct compiler *c, struct node *node) {
+    struct program *prog = c->prog;
+    int first = prog->segments_size;
+    const char *name = c->source + node->pos;
+    const char *end = name + node->len;
+
+    while (1) {
+        const char *dot = memchr(name, '.', end - name);
+        int l = (dot ? dot : end) - name;
+
+        if (prog->segments_size == prog->segments_cap) {
+            prog->segments_cap = prog->segments_cap ? prog->segments_cap * 2 : 8;
+            prog->segments = realloc(prog->segments, prog->segments_cap * sizeof *prog->segments);
+            if (!prog->segments) {
+                errx(EXIT_FAILURE, "out of memory");
+            }
+        }
+
+        struct segment *s = &prog->segments[prog->segments_size++];
+        s->name = intern(prog, name, l);
+        s->length = l;
+        s->hash = hashmap_hash(name, l);
+        s->last = dot == NULL;
+
+        if (dot == NULL) {
+            return first;
+        }
+        name = dot + 1;
+    }
+}
+
+/* number of loops between a variable and the innermost loop it is the variable of, or -1 if it is not a loop variable */
+static int loop_depth(struct compiler *c, const char *name, int l) {
+    for (int i = c->scope_size - 1; i >= c->scope_base; i--) {
+        if (c->scope[i].len == l && memcmp(c->source + c->scope[i].pos, name, l) == 0) {
+            return c->scope_size - 1 - i;
+        }
+    }
+
+    return -1;
+}
+
+static const char *loop_fields[] = {
+    [LOOP_INDEX] = "loop.index",
+    [LOOP_FIRST] = "loop.first",
+    [LOOP_LAST] = "loop.last",
+};
+
+/* variables of loops and the fields of "loop" are resolved to the loop at compile time, other variables are looked up by name */
+static void compile_symbol(struct compiler *c, struct node *expr) {
+    const char *name = c->source + expr->pos;
+    const char *dot = memchr(name, '.', expr->len);
+    int l = dot ? dot - name : expr->len;
+    int depth = loop_depth(c, name, l);
+    if (depth >= 0) {
+        emit(c, OP_LOAD_LOCAL, intern_path(c, expr), depth, 0);
+        return;
+    }
+
+    /* a loop variable named loop shadows the fields */
+    if (c->scope_size > c->scope_base && loop_depth(c, "loop", 4) < 0) {
+        for (int i=0; i < (int) (sizeof loop_fields / sizeof *loop_fields); i++) {
+            if ((int) strlen(loop_fields[i]) == expr->len && memcmp(loop_fields[i], name, expr->len) == 0) {
+                emit(c, OP_LOOP_FIELD, i, 0, 0);
+                return;
+            }
+        }
+    }
+
+    emit(c, OP_LOAD, intern_path(c, expr), 0, 0);
+}
+
+static void compile_expression(struct compiler *c, struct node *expr) {
+    switch (expr->type) {
+        case NODE_SYMBOL:
+            compile_symbol(c, expr);
+        break;
+
+        case NODE_NUMBER:
+            emit(c, OP_PUSH_INT, expr->value, 0, 0);
+        break;
+
+        case NODE_STRING:
+            emit(c, OP_PUSH_STRING, intern_node(c, expr), expr->len, 0);
+        break;
+
+        case NODE_NOT:
+            compile_expression(c, expr->expr);
+            emit(c, OP_NOT, 0, 0, 0);
+        break;
+
+        case NODE_BINARY:
+            compile_expression(c, expr->expr);
+            compile_expression(c, expr->alt);
+            emit(c, binary_opcodes[expr->value], 0, 0, 0);
+        break;
+
+        case NODE_FILTER:
+            compile_expression(c, expr->expr);
+            for (struct node *arg = expr->alt; arg != NULL; arg = arg->next) {
+                compile_expression(c, arg);
+            }
+            emit(c, OP_FILTER, intern_node(c, expr), c->filters++, expr->value);
+        break;
+
+        default:
+            errx(EXIT_FAILURE, "unexpected node in expression");
+    }
+}
+
+static void compile_body(struct compiler *c, struct node *node);
+
+static void compile_node(struct compiler *c, struct node *t) {
+    c->line = t->line;
+
+    /* maybe eat whitespace going backward */
+    if (t->trim & TRIM_OPEN_LEFT) {
+        emit_rtrim(c);
+    }
+
+    switch (t->type) {
+        case NODE_TEXT:
+            emit_text(c, c->source + t->pos, t->len);
+        break;
+
+        case NODE_PRINT:
+            emit_set_trim(c, t->trim & TRIM_OPEN_RIGHT);
+            compile_expression(c, t->expr);
+            emit(c, OP_PRINT, 0, 0, 0);
+        break;
+
+        case NODE_BLOCK: {
+            emit_set_trim(c, t->trim & TRIM_OPEN_RIGHT);
+            int block = emit(c, OP_BLOCK, intern_node(c, t), t->len, 0);
+            int start = label(c);
+            int scope_base = c->scope_base;
+            c->scope_base = c->scope_size;
+            compile_body(c, t->body);
+            c->scope_base = scope_base;
+            c->line = t->line;
+            patch(c, block, label(c));
+
+            c->blocks = realloc(c->blocks, (c->nblocks + 1) * sizeof *c->blocks);
+            c->blocks[c->nblocks].name = c->prog->code[block].a;
+            c->blocks[c->nblocks].start = start;
+            c->blocks[c->nblocks].end = c->prog->code[block].c;
+            c->nblocks++;
+
+            emit_set_trim(c, t->trim & TRIM_END_RIGHT);
+        }
+        break;
+
+        case NODE_EXTENDS:
+            c->parent = intern_node(c, t);
+        break;
+
+        case NODE_FOR: {
+            int begin;
+            if (t->expr->type == NODE_RANGE) {
+                compile_expression(c, t->expr->expr);
+                begin = emit(c, OP_FOR_RANGE, intern_node(c, t), 0, 0);
+            } else {
+                begin = emit(c, OP_FOR_BEGIN, intern_node(c, t), intern_path(c, t->expr), 0);
+            }
+            int body = label(c);
+            emit_set_trim(c, t->trim & TRIM_OPEN_RIGHT);
+            if (c->scope_size == c->scope_cap) {
+                c->scope_cap = c->scope_cap ? c->scope_cap * 2 : 8;
+                c->scope = realloc(c->scope, c->scope_cap * sizeof *c->scope);
+                if (!c->scope) {
+                    errx(EXIT_FAILURE, "out of memory");
+                }
+            }
+            c->scope[c->scope_size].pos = t->pos;
+            c->scope[c->scope_size].len = t->len;
+            c->scope_size++;
+            compile_body(c, t->body);
+            c->scope_size--;
+            c->line = t->line;
+            emit(c, OP_FOR_NEXT, body, 0, 0);
+            patch(c, begin, label(c));
+
+            /* trim trailing whitespace if closing tag has minus sign */
+            if (t->trim & TRIM_END_LEFT) {
+                emit_rtrim(c);
+            }
+            emit_set_trim(c, t->trim & TRIM_END_RIGHT);
+        }
+        break;
+
+        case NODE_IF: {
+            /* without an else tag, the endif tag directly follows the body */
+            int trim_after_body_left = t->value ? TRIM_ELSE_LEFT : TRIM_END_LEFT;
+            int trim_after_body_right = t->value ? TRIM_ELSE_RIGHT : TRIM_END_RIGHT;
+
+            compile_expression(c, t->expr);
+            int jmp_else = emit(c, OP_JMP_FALSE, 0, 0, 0);
+            emit_set_trim(c, t->trim & TRIM_OPEN_RIGHT);
+            compile_body(c, t->body);
+            c->line = t->line;
+            if (t->trim & trim_after_body_left) {
+                emit_rtrim(c);
+            }
+            emit_set_trim(c, t->trim & trim_after_body_right);
+
+            if (t->value) {
+                int jmp_end = emit(c, OP_JMP, 0, 0, 0);
+                patch(c, jmp_else, label(c));
+                emit_set_trim(c, t->trim & TRIM_ELSE_RIGHT);
+                compile_body(c, t->alt);
+                c->line = t->line;
+                if (t->trim & TRIM_END_LEFT) {
+                    emit_rtrim(c);
+                }
+                emit_set_trim(c, t->trim & TRIM_END_RIGHT);
+                patch(c, jmp_end, label(c));
+            } else {
+                patch(c, jmp_else, label(c));
+            }
+        }
+        break;
+
+        default:
+            errx(EXIT_FAILURE, "unexpected node in template body");
+    }
+}
+
+static void compile_body(struct compiler *c, struct node *node) {
+    for (; node != NULL; node = node->next) {
+        compile_node(c, node);
+    }
+}
+
+static struct program *program_new() {
+    struct program *prog = malloc(sizeof *prog);
+    if (!prog) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    prog->cap = 64;
+    prog->size = 0;
+    prog->code = malloc(prog->cap * sizeof *prog->code);
+    prog->positions = malloc(prog->cap * sizeof *prog->positions);
+    prog->strings_cap = 256;
+    prog->strings_size = 0;
+    prog->strings = malloc(prog->strings_cap);
+    prog->segments = NULL;
+    prog->segments_size = 0;
+    prog->segments_cap = 0;
+    prog->blocks = NULL;
+    prog->parent = NULL;
+    prog->mapped = 0;
+    if (!prog->code || !prog->positions || !prog->strings) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    return prog;
+}
+
+/* give back unused capacity, as a compiled program is kept for as long as its env */
+static void shrink(struct program *prog) {
+    prog->code = realloc(prog->code, prog->size * sizeof *prog->code);
+    prog->positions = realloc(prog->positions, prog->size * sizeof *prog->positions);
+    prog->cap = prog->size;
+    if (prog->strings_size > 0) {
+        prog->strings = realloc(prog->strings, prog->strings_size);
+        prog->strings_cap = prog->strings_size;
+    }
+    if (prog->segments_size > 0) {
+        prog->segments = realloc(prog->segments, prog->segments_size * sizeof *prog->segments);
+        prog->segments_cap = prog->segments_size;
+    }
+    if (!prog->code || !prog->positions || !prog->strings || (prog->segments_size > 0 && !prog->segments)) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+}
+
+/* lower a parsed template to a program */
+struct program *compile(struct ast *ast) {
+    struct program *prog = program_new();
+
+    struct compiler c = {
+        .prog = prog,
+        .source = ast->source,
+        .barrier = 0,
+        .blocks = NULL,
+        .nblocks = 0,
+        .parent = -1,
+        .line = 1,
+        .scope = NULL,
+        .scope_size = 0,
+        .scope_cap = 0,
+        .scope_base = 0,
+        .filters = 0,
+    };
+    compile_body(&c, ast->root);
+    label(&c);
+    emit(&c, OP_HALT, 0, 0, 0);
+    shrink(prog);
+
+    /* string pool does not move anymore, so we can safely point into it */
+    prog->parent = c.parent >= 0 ? prog->strings + c.parent : NULL;
+    prog->blocks = hashmap_new();
+    for (int i=0; i < c.nblocks; i++) {
+        struct block *b = malloc(sizeof *b);
+        b->start = c.blocks[i].start;
+        b->end = c.blocks[i].end;
+        hashmap_insert(prog->blocks, prog->strings + c.blocks[i].name, b);
+    }
+    free(c.blocks);
+    free(c.scope);
+
+    return prog;
+}
+
+#define MAX_BLOCK_DEPTH 64
+
+struct linker {
+    struct program *out;
+
+    /* template and its ancestors, root last */
+    struct program **chain;
+    int n;
+
+    /* position of the string pool and segments of each program of the chain in the output */
+    int *string_base;
+    int *segment_base;
+
+    /* name of the template of each program of the chain in the output string pool, -1 for the template itself */
+    int *names;
+
+    int depth;
+
+    /* number of filters in the output so far */
+    int filters;
+};
+
+/* find the body of a block in the "lowest" template that defines it, returns the index of its program in the chain */
+static int find_block(struct linker *l, const char *name, struct block **block) {
+    for (int i=0; i < l->n; i++) {
+        *block = hashmap_get(l->chain[i]->blocks, (char *) name);
+        if (*block) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* copy instructions [start, end) of the p-th program of the chain to the output, inlining the winning body of every block.
+   block instructions are kept as markers around the inlined body, so a profile can attribute time to blocks.
+   returns -1 if blocks are nested too deeply. */
+static int link_range(struct linker *l, int p, int start, int end) {
+    struct program *src = l->chain[p];
+    struct program *out = l->out;
+
+    /* output position of every source instruction, and the copied instructions that still jump to source positions */
+    int *map = malloc((end - start + 1) * sizeof *map);
+    int *jumps = malloc((end - start + 1) * sizeof *jumps);
+    int njumps = 0;
+    if (!map || !jumps) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+
+    int pc = start;
+    while (pc < end) {
+        struct instr ins = src->code[pc];
+        struct source_pos pos = { l->names[p], src->positions[pc].line };
+        map[pc - start] = out->size;
+
+        switch (ins.op) {
+            case OP_BLOCK: {
+                char *name = src->strings + ins.a;
+                struct block *block;
+                int q = find_block(l, name, &block);
+                if (++l->depth > MAX_BLOCK_DEPTH) {
+                    free(map);
+                    free(jumps);
+                    return -1;
+                }
+                ins.a += l->string_base[p];
+                int marker = append(out, ins, pos);
+                if (link_range(l, q, block->start, block->end) != 0) {
+                    free(map);
+                    free(jumps);
+                    return -1;
+                }
+                out->code[marker].c = out->size;
+                l->depth--;
+
+                /* default body is skipped, nothing outside of it jumps into it */
+                for (int i = pc + 1; i < ins.c; i++) {
+                    map[i - start] = -1;
+                }
+                pc = ins.c;
+                continue;
+            }
+
+            case OP_TEXT:
+            case OP_PUSH_STRING:
+                ins.a += l->string_base[p];
+            break;
+
+            case OP_FILTER:
+                ins.a += l->string_base[p];
+                ins.b = l->filters++;
+            break;
+
+            case OP_LOAD:
+            case OP_LOAD_LOCAL:
+                ins.a += l->segment_base[p];
+            break;
+
+            case OP_FOR_BEGIN:
+                ins.a += l->string_base[p];
+                ins.b += l->segment_base[p];
+                jumps[njumps++] = out->size;
+            break;
+
+            case OP_FOR_RANGE:
+                ins.a += l->string_base[p];
+                jumps[njumps++] = out->size;
+            break;
+
+            case OP_JMP:
+            case OP_JMP_FALSE:
+            case OP_FOR_NEXT:
+                jumps[njumps++] = out->size;
+            break;
+
+            default:
+            break;
+        }
+
+        append(out, ins, pos);
+        pc++;
+    }
+    map[end - start] = out->size;
+
+    /* control flow is structured, so jumps never leave the range they are in */
+    for (int i=0; i < njumps; i++) {
+        struct instr *ins = &out->code[jumps[i]];
+        if (ins->op == OP_FOR_BEGIN || ins->op == OP_FOR_RANGE) {
+            ins->c = map[ins->c - start];
+        } else {
+            ins->a = map[ins->a - start];
+        }
+    }
+
+    free(map);
+    free(jumps);
+    return 0;
+}
+
+/*
+ * Link a template with its ancestors (chain[0] being the template itself and chain[n-1] the root)
+ * into a single program, in which every block is replaced by the body of its lowest override.
+ * Returns NULL if blocks are nested more than MAX_BLOCK_DEPTH deep.
+ */
+struct program *program_link(struct program **chain, int n) {
+    struct program *out = program_new();
+    int string_base[n];
+    int segment_base[n];
+    int names[n];
+
+    for (int i=0; i < n; i++) {
+        struct program *prog = chain[i];
+        string_base[i] = out->strings_size;
+        segment_base[i] = out->segments_size;
+
+        /* pools are NUL-separated strings, so they can be copied as a whole */
+        if (prog->strings_size > 0) {
+            string_base[i] = intern(out, prog->strings, prog->strings_size - 1);
+        }
+
+        if (out->segments_size + prog->segments_size > out->segments_cap) {
+            out->segments_cap = out->segments_size + prog->segments_size;
+            out->segments = realloc(out->segments, out->segments_cap * sizeof *out->segments);
+            if (!out->segments) {
+                errx(EXIT_FAILURE, "out of memory");
+            }
+        }
+        for (int j=0; j < prog->segments_size; j++) {
+            struct segment s = prog->segments[j];
+            s.name += string_base[i];
+            out->segments[out->segments_size++] = s;
+        }
+
+        /* every ancestor is named by the parent of the template below it */
+        names[i] = i == 0 ? -1 : chain[i - 1]->parent - chain[i - 1]->strings + string_base[i - 1];
+    }
+
+    struct linker l = {
+        .out = out,
+        .chain = chain,
+        .n = n,
+        .string_base = string_base,
+        .segment_base = segment_base,
+        .names = names,
+        .depth = 0,
+        .filters = 0,
+    };
+    struct program *root = chain[n - 1];
+    out->blocks = hashmap_new();
+    if (link_range(&l, n - 1, 0, root->size) != 0) {
+        program_free(out);
+        return NULL;
+    }
+    shrink(out);
+    return out;
+}
+
+/* approximate number of bytes used by a program */
+size_t program_size(struct program *prog) {
+    size_t size = sizeof *prog;
+    size += prog->cap * (sizeof *prog->code + sizeof *prog->positions);
+    size += prog->strings_cap;
+    size += prog->segments_cap * sizeof *prog->segments;
+    return size + program_blocks_size(prog);
+}
+
+/* number of bytes used by the block map of a program */
+size_t program_blocks_size(struct program *prog) {
+    size_t size = sizeof *prog->blocks + prog->blocks->cap * sizeof *prog->blocks->entries;
+    return size + prog->blocks->size * sizeof(struct block);
+}
+
+void program_free(struct program *prog) {
+    hashmap_walk(prog->blocks, free);
+    hashmap_free(prog->blocks);
+    if (!prog->mapped) {
+        free(prog->segments);
+        free(prog->strings);
+        free(prog->code);
+        free(prog->positions);
+    }
+    free(prog);
+}
@@ -0,0 +1,40 @@
+/*
+ * Runtime for templates compiled to C by unja-compile. The generated code calls these instead of
+ * interpreting a program, sharing the semantics of every instruction with the virtual machine.
+ * Include after template.h, program.h and object.h.
+ */
+struct compiled_render;
+
+/* template compiled to a C function, as listed by the generated code in order of name */
+struct compiled_template {
+    const char *name;
+    void (*render)(struct compiled_render *r);
+};
+
+char *compiled_render_template(const struct compiled_template *templates, int n, int autoescape, struct env *env, char *template_name, struct hashmap *vars);
+void compiled_text(struct compiled_render *r, const char *str, size_t l, int trimmed);
+void compiled_print(struct compiled_render *r, struct unja_object *obj);
+struct unja_object compiled_load(struct compiled_render *r, struct program *prog, int segment);
+struct unja_object compiled_load_local(struct compiled_render *r, struct program *prog, int segment, int depth);
+int compiled_loop_field(struct compiled_render *r, enum loop_field field);
+const struct unja_filter *compiled_find_filter(struct compiled_render *r, const char *name);
+void compiled_filter(struct compiled_render *r, const char *name, const struct unja_filter *filter, struct unja_object *obj, struct unja_object *args, int nargs);
+void compiled_binary(struct compiled_render *r, struct unja_object *left, enum opcode op, struct unja_object *right);
+int compiled_for_begin(struct compiled_render *r, struct program *prog, int segment, char *key);
+int compiled_for_range(struct compiled_render *r, int count, char *key);
+int compiled_for_next(struct compiled_render *r);
+void compiled_set_trim(struct compiled_render *r, int trim);
+void compiled_rtrim(struct compiled_render *r);
+struct arena *compiled_arena(struct compiled_render *r);
+
+/* builtin filters, called directly by compiled templates */
+void filter_trim(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+void filter_lower(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+void filter_wordcount(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+void filter_length(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+void filter_escape(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+void filter_safe(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+void filter_truncate(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+
+/* for unja-compile: call fn with the linked program of every template in a (non-lazy) env */
+void env_each_template(struct env *env, void (*fn)(char *name, struct program *prog, void *data), void *data);
@@ -0,0 +1,80 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "escape.h"
+
+/* replacements by character, NULL for characters that are output as they are */
+static const char *entities[256] = {
+    ['&'] = "&amp;",
+    ['<'] = "&lt;",
+    ['>'] = "&gt;",
+    ['"'] = "&#34;",
+    ['\''] = "&#39;",
+};
+
+static const unsigned char entity_lengths[256] = {
+    ['&'] = 5,
+    ['<'] = 4,
+    ['>'] = 4,
+    ['"'] = 5,
+    ['\''] = 5,
+};
+
+/* number of characters at the start of str that do not have to be escaped */
+size_t html_escape_span(const char *str, size_t l) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i apos = _mm_set1_epi8('\'');
+    for (; i + 16 <= l; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quot)), _mm_cmpeq_epi8(v, apos)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < l; i++) {
+        if (entity_lengths[(unsigned char) str[i]]) {
+            break;
+        }
+    }
+    return i;
+}
+
+/* replacement of a character that has to be escaped, storing its length in *length */
+const char *html_entity(char c, size_t *length) {
+    *length = entity_lengths[(unsigned char) c];
+    return entities[(unsigned char) c];
+}
+
+/* escape str into dest, which has room for HTML_ESCAPE_MAX * l characters. returns the length written. */
+size_t html_escape(char *dest, const char *str, size_t l) {
+    char *d = dest;
+    while (l > 0) {
+        size_t n = html_escape_span(str, l);
+        memcpy(d, str, n);
+        d += n;
+        str += n;
+        l -= n;
+        if (l > 0) {
+            size_t el;
+            const char *entity = html_entity(*str, &el);
+            memcpy(d, entity, el);
+            d += el;
+            str++;
+            l--;
+        }
+    }
+    return d - dest;
+}
@@ -0,0 +1,12 @@
+/*
+ * HTML escaping of the characters that can start markup or end an attribute value: & < > " '.
+ * Text without them is found a vector at a time, so clean text can be copied in bulk.
+ */
+#include <stddef.h>
+
+/* longest replacement of a single character */
+#define HTML_ESCAPE_MAX 5
+
+size_t html_escape_span(const char *str, size_t l);
+const char *html_entity(char c, size_t *length);
+size_t html_escape(char *dest, const char *str, size_t l);
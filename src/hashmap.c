@@ -2,96 +2,166 @@
 #include <stdlib.h>
 #include <err.h>
 #include "hashmap.h"
+#include "stats.h"
 
-struct node {
-    char *key;
-    void *value;
-    struct node *next;
-};
-
-unsigned long
-hash(char *str)
+unsigned int
+hashmap_hash(const char *str, size_t length)
 {
-    unsigned long hash = 5381;
-    int c;
+    unsigned int hash = 5381;
 
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    for (size_t i=0; i < length; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char) str[i]; /* hash * 33 + c */
     }
 
     return hash;
 }
 
-/* allocate a new hashmap */
-struct hashmap *hashmap_new() {
+static struct hashmap_entry *alloc_entries(size_t cap) {
+    struct hashmap_entry *entries = calloc(cap, sizeof *entries);
+    if (!entries) err(EXIT_FAILURE, "out of memory");
+    count_alloc(cap * sizeof *entries);
+    return entries;
+}
+
+/* allocate a new hashmap with room for at least cap entries before it has to grow */
+struct hashmap *hashmap_new_with_cap(size_t cap) {
     struct hashmap *hm = malloc(sizeof *hm);
     if (!hm) err(EXIT_FAILURE, "out of memory");
-    for (int i=0; i < HASHMAP_CAP; i++) {
-        hm->buckets[i] = NULL;
-    }
+    count_alloc(sizeof *hm);
 
+    /* capacity is a power of two, kept at most 3/4 full */
+    hm->cap = HASHMAP_INITIAL_CAP;
+    while (hm->cap * 3 / 4 < cap) {
+        hm->cap *= 2;
+    }
+    hm->size = 0;
+    hm->entries = alloc_entries(hm->cap);
     return hm;
 }
 
-/* Inserts a key-value pair into the map. Returns NULL if map did not have key, old value if it did. */
-void *hashmap_insert(struct hashmap *hm, char *key, void *value) {
-    int pos = hash(key) % HASHMAP_CAP;
-    struct node *head = hm->buckets[pos];
-    struct node *node = head;
-    void *old_value;
-
-    while (node) {
-        if (strcmp(node->key, key) == 0) {
-            old_value = node->value;
-            node->value = value;
-            return old_value;
+/* allocate a new hashmap */
+struct hashmap *hashmap_new() {
+    return hashmap_new_with_cap(0);
+}
+
+/* returns the slot holding key, or the empty slot where it would be inserted. adds the number of slots inspected to probes, if not NULL. */
+static struct hashmap_entry *find(struct hashmap *hm, const char *key, size_t length, unsigned int h, size_t *probes) {
+    size_t mask = hm->cap - 1;
+    for (size_t pos = h & mask;; pos = (pos + 1) & mask) {
+        struct hashmap_entry *e = &hm->entries[pos];
+        if (probes) {
+            (*probes)++;
+        }
+        if (e->key == NULL || (e->hash == h && e->length == length && memcmp(e->key, key, length) == 0)) {
+            return e;
         }
-        node = node->next;
     }
-    
-    node = malloc(sizeof *node);
-    node->key = key;
-    node->value = value;
-    node->next = head;
-    hm->buckets[pos] = node;
-    return NULL;
 }
 
-/* Returns a pointer to the value corresponding to the key. */
-void *hashmap_get(struct hashmap *hm, char *key) {
-    unsigned int pos = hash(key) % HASHMAP_CAP;
-    struct node *node = hm->buckets[pos];
-    while (node != NULL) {
-        if (strcmp(node->key, key) == 0) {
-            return node->value;
+/* move all entries to a table of cap slots, cap being a larger power of two */
+static void resize(struct hashmap *hm, size_t cap) {
+    struct hashmap_entry *old = hm->entries;
+    size_t old_cap = hm->cap;
+
+    hm->cap = cap;
+    hm->entries = alloc_entries(hm->cap);
+    for (size_t i=0; i < old_cap; i++) {
+        if (old[i].key != NULL) {
+            *find(hm, old[i].key, old[i].length, old[i].hash, NULL) = old[i];
         }
+    }
+    free(old);
+}
+
+/* insert value, flagged as a struct unja_value or not */
+static void *insert(struct hashmap *hm, char *key, void *value, int typed) {
+    size_t length = strlen(key);
+    unsigned int h = hashmap_hash(key, length);
+    struct hashmap_entry *e = find(hm, key, length, h, NULL);
+
+    /* the key is replaced as well, as the one previously inserted may not outlive its value */
+    if (e->key != NULL) {
+        void *old_value = e->value;
+        e->key = key;
+        e->value = value;
+        e->typed = typed;
+        return old_value;
+    }
 
-        node = node->next;
+    if ((hm->size + 1) > hm->cap * 3 / 4) {
+        resize(hm, hm->cap * 2);
+        e = find(hm, key, length, h, NULL);
     }
 
+    e->key = key;
+    e->value = value;
+    e->hash = h;
+    e->length = length;
+    e->typed = typed;
+    hm->size++;
     return NULL;
 }
 
+/* Inserts a key-value pair into the map. Returns NULL if map did not have key, old value if it did. */
+void *hashmap_insert(struct hashmap *hm, char *key, void *value) {
+    return insert(hm, key, value, 0);
+}
+
+/* Like hashmap_insert(), for a typed template variable. */
+void *hashmap_insert_value(struct hashmap *hm, char *key, struct unja_value *value) {
+    return insert(hm, key, value, 1);
+}
+
+/* Inserts n key-value pairs, growing the map at most once. */
+void hashmap_insert_all(struct hashmap *hm, char **keys, void **values, size_t n) {
+    size_t cap = hm->cap;
+    while ((hm->size + n) > cap * 3 / 4) {
+        cap *= 2;
+    }
+    if (cap != hm->cap) {
+        resize(hm, cap);
+    }
+
+    for (size_t i=0; i < n; i++) {
+        hashmap_insert(hm, keys[i], values[i]);
+    }
+}
+
+/* Returns a pointer to the value corresponding to the key. */
+void *hashmap_get(struct hashmap *hm, char *key) {
+    size_t length = strlen(key);
+    return find(hm, key, length, hashmap_hash(key, length), NULL)->value;
+}
+
+/* Returns the value for a key of the given length with a precomputed hashmap_hash(). key does not have to be NUL-terminated. */
+void *hashmap_get_hashed(struct hashmap *hm, const char *key, size_t length, unsigned int hash) {
+    return find(hm, key, length, hash, NULL)->value;
+}
+
+/* Like hashmap_get_hashed(), adding the number of slots inspected to probes. */
+void *hashmap_get_probed(struct hashmap *hm, const char *key, size_t length, unsigned int hash, size_t *probes) {
+    return find(hm, key, length, hash, probes)->value;
+}
+
+/* Like hashmap_get_probed(), returning the slot of the key. Its key is NULL if the map does not have it. probes may be NULL. */
+struct hashmap_entry *hashmap_get_entry(struct hashmap *hm, const char *key, size_t length, unsigned int hash, size_t *probes) {
+    return find(hm, key, length, hash, probes);
+}
+
 /* Retrieve pointer to value by key, handles dot notation for nested hashmaps */
 void *hashmap_resolve(struct hashmap *hm, char *key) {
-    char tmp_key[64];
-    int i = 0;
-    int j = 0;
+    while (hm != NULL) {
+        char *dot = strchr(key, '.');
+        size_t length = dot ? (size_t) (dot - key) : strlen(key);
+        hm = find(hm, key, length, hashmap_hash(key, length), NULL)->value;
 
-    while (1) {
-        for (j=0; key[i] != '.' && key[i] != '\0'; i++, j++) {
-            tmp_key[j] = key[i];
-        }
-        tmp_key[j] = '\0';
-        hm = hashmap_get(hm, tmp_key);
-        
         // stop if we read key to end of string
-        if (key[i] == '\0') {
+        if (dot == NULL) {
             break;
         }
 
         // otherwise, continue reading keys
-        i++;
+        key = dot + 1;
     }
 
     return hm;
@@ -99,57 +169,43 @@ void *hashmap_resolve(struct hashmap *hm, char *key) {
 
 /* Removes a key from the map, returning the value at the key if the key was previously in the map. */
 void *hashmap_remove(struct hashmap *hm, char *key) {
-    int pos = hash(key) % HASHMAP_CAP;
-    struct node *node = hm->buckets[pos];
-    struct node *prev = NULL;
-    void *old_value;
-
-    while (node) {
-        if (strcmp(node->key, key) == 0) {
-            if (prev) {
-                prev->next = node->next;
-            } else {
-                hm->buckets[pos] = node->next;
-            }
-            old_value = node->value;
-            free(node);            
-            return old_value;
-        }
-
-        node = node->next;
-        prev = node;
+    size_t length = strlen(key);
+    struct hashmap_entry *e = find(hm, key, length, hashmap_hash(key, length), NULL);
+    if (e->key == NULL) {
+        return NULL;
     }
 
-    return NULL;
+    void *old_value = e->value;
+    hm->size--;
+
+    /* shift following entries of the probe sequence back, so no tombstone is needed */
+    size_t mask = hm->cap - 1;
+    size_t hole = e - hm->entries;
+    for (size_t pos = (hole + 1) & mask; hm->entries[pos].key != NULL; pos = (pos + 1) & mask) {
+        size_t home = hm->entries[pos].hash & mask;
+
+        /* entry can move into the hole if its home slot does not lie cyclically in (hole, pos] */
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            hm->entries[hole] = hm->entries[pos];
+            hole = pos;
+        }
+    }
+    hm->entries[hole].key = NULL;
+    hm->entries[hole].value = NULL;
+    hm->entries[hole].typed = 0;
+    return old_value;
 }
 
 void hashmap_walk(struct hashmap *hm, void (*fn)(void *value)) {
-    struct node *node;
-    struct node *next;
-
-    for (int i=0; i < HASHMAP_CAP; i++) {
-        node = hm->buckets[i];
-        while (node) {
-            next = node->next;
-            fn(node->value);
-            node = next;
+    for (size_t i=0; i < hm->cap; i++) {
+        if (hm->entries[i].key != NULL) {
+            fn(hm->entries[i].value);
         }
     }
 }
 
 /* free hashmap related memory */
 void hashmap_free(struct hashmap *hm) {
-    struct node *node;
-    struct node *next;
-
-    for (int i=0; i < HASHMAP_CAP; i++) {
-        node = hm->buckets[i];
-        while (node) {
-            next = node->next;
-            free(node);            
-            node = next;
-        }
-    }
-
+    free(hm->entries);
     free(hm);
-}
\ No newline at end of file
+}
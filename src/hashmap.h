@@ -1,13 +1,36 @@
-#define HASHMAP_CAP 26
+#include <stddef.h>
 
+#define HASHMAP_INITIAL_CAP 16
+
+struct unja_value;
+
+/* slot of the hashmap. key is NULL for empty slots. typed is set if value is a struct unja_value. */
+struct hashmap_entry {
+    char *key;
+    void *value;
+    unsigned int hash;
+    unsigned int length : 31;
+    unsigned int typed : 1;
+};
+
+/* open-addressing hashmap with linear probing. keys are not copied. */
 struct hashmap {
-    struct node *buckets[HASHMAP_CAP];
+    struct hashmap_entry *entries;
+    size_t cap;
+    size_t size;
 };
 
 struct hashmap *hashmap_new();
+struct hashmap *hashmap_new_with_cap(size_t cap);
 void *hashmap_insert(struct hashmap *hm, char *key, void *value);
+void *hashmap_insert_value(struct hashmap *hm, char *key, struct unja_value *value);
+void hashmap_insert_all(struct hashmap *hm, char **keys, void **values, size_t n);
 void *hashmap_get(struct hashmap *hm, char *key);
+void *hashmap_get_hashed(struct hashmap *hm, const char *key, size_t length, unsigned int hash);
+void *hashmap_get_probed(struct hashmap *hm, const char *key, size_t length, unsigned int hash, size_t *probes);
+struct hashmap_entry *hashmap_get_entry(struct hashmap *hm, const char *key, size_t length, unsigned int hash, size_t *probes);
+unsigned int hashmap_hash(const char *key, size_t length);
 void *hashmap_resolve(struct hashmap *hm, char *key);
 void *hashmap_remove(struct hashmap *hm, char *key);
 void hashmap_free(struct hashmap *hm);
-void hashmap_walk(struct hashmap *hm, void (*fn)(void *value));
\ No newline at end of file
+void hashmap_walk(struct hashmap *hm, void (*fn)(void *value));
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "object.h"
+#include "arena.h"
+
+const struct unja_object null_object = {
+    .type = OBJ_NULL,
+};
+
+struct unja_object make_int_object(int value) {
+    struct unja_object obj;
+    obj.type = OBJ_INT;
+    obj.integer = value;
+    return obj;
+}
+
+struct unja_object make_float_object(double value) {
+    struct unja_object obj;
+    obj.type = OBJ_FLOAT;
+    obj.number = value;
+    return obj;
+}
+
+/* list or map object of the given number of items */
+struct unja_object make_collection_object(enum unja_object_type type, size_t length) {
+    struct unja_object obj;
+    obj.type = type;
+    obj.length = length;
+    return obj;
+}
+
+/* string object referencing str without copying it. str has to outlive the object. */
+struct unja_object make_string_view(const char *str, size_t length) {
+    struct unja_object obj;
+    obj.type = OBJ_STRING;
+    obj.storage = STR_BORROWED;
+    obj.string = (char *) str;
+    obj.length = length;
+    obj.safe = 0;
+    return obj;
+}
+
+/* allocate a string object with room for length characters, inline if it fits */
+static struct unja_object make_string_storage(struct arena *arena, size_t length) {
+    struct unja_object obj;
+    obj.type = OBJ_STRING;
+    obj.length = length;
+    obj.safe = 0;
+    if (length <= OBJECT_INLINE_SIZE) {
+        obj.storage = STR_INLINE;
+        obj.string = NULL;
+    } else {
+        obj.storage = STR_OWNED;
+        obj.string = arena_alloc(arena, length);
+    }
+    return obj;
+}
+
+/* string object holding a copy of str */
+struct unja_object make_string_object(struct arena *arena, const char *str, size_t length) {
+    struct unja_object obj = make_string_storage(arena, length);
+    memcpy(object_mutable_string(arena, &obj), str, length);
+    return obj;
+}
+
+struct unja_object concat_objects(struct arena *arena, const struct unja_object *left, const struct unja_object *right) {
+    struct unja_object obj = make_string_storage(arena, left->length + right->length);
+    char *str = object_mutable_string(arena, &obj);
+    memcpy(str, object_string(left), left->length);
+    memcpy(str + left->length, object_string(right), right->length);
+    return obj;
+}
+
+const char *object_string(const struct unja_object *obj) {
+    return obj->storage == STR_INLINE ? obj->small : obj->string;
+}
+
+/* characters of a string object that may be modified, copying them first if they are borrowed */
+char *object_mutable_string(struct arena *arena, struct unja_object *obj) {
+    if (obj->storage == STR_BORROWED) {
+        int safe = obj->safe;
+        *obj = make_string_object(arena, obj->string, obj->length);
+        obj->safe = safe;
+    }
+
+    return obj->storage == STR_INLINE ? obj->small : obj->string;
+}
+
+int object_to_int(const struct unja_object *obj) {
+    switch (obj->type) {
+        case OBJ_NULL: return 0;
+        case OBJ_INT: return obj->integer;
+        case OBJ_FLOAT: return (int) obj->number;
+        case OBJ_STRING: break;
+        case OBJ_LIST: 
+        case OBJ_MAP: return obj->length;
+    }
+
+    /* same as atoi, but bounded by the string length */
+    const char *s = object_string(obj);
+    const char *end = s + obj->length;
+    while (s < end && isspace(*s)) {
+        s++;
+    }
+
+    int sign = 1;
+    if (s < end && (*s == '-' || *s == '+')) {
+        sign = *s == '-' ? -1 : 1;
+        s++;
+    }
+
+    int value = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        value = value * 10 + (*s++ - '0');
+    }
+    return sign * value;
+}
+
+double object_to_float(const struct unja_object *obj) {
+    switch (obj->type) {
+        case OBJ_FLOAT: return obj->number;
+        case OBJ_STRING: break;
+        default: return object_to_int(obj);
+    }
+
+    /* strings are not NUL-terminated, and longer ones are not numbers anyway */
+    char buf[FLOAT_FORMAT_SIZE];
+    size_t l = obj->length < sizeof buf - 1 ? obj->length : sizeof buf - 1;
+    memcpy(buf, object_string(obj), l);
+    buf[l] = '\0';
+    return strtod(buf, NULL);
+}
+
+/* shortest representation that reads back as the same value, always with a decimal point or exponent like Jinja */
+size_t format_float(char *buf, double value) {
+    int l = 0;
+    for (int precision = 1; precision <= 17; precision++) {
+        l = snprintf(buf, FLOAT_FORMAT_SIZE, "%.*g", precision, value);
+        if (strtod(buf, NULL) == value) {
+            break;
+        }
+    }
+
+    /* %g switches to an exponent once there are more digits before the point than the precision, eg 2e+01 for 20 */
+    if (strchr(buf, 'e') != NULL) {
+        char full[FLOAT_FORMAT_SIZE];
+        int n = snprintf(full, sizeof full, "%.17g", value);
+        if (strchr(full, 'e') == NULL) {
+            memcpy(buf, full, n + 1);
+            l = n;
+        }
+    }
+
+    if (strpbrk(buf, ".eninf") == NULL) {
+        memcpy(buf + l, ".0", 3);
+        l += 2;
+    }
+    return l;
+}
+
+/* convert an object to the string it renders as */
+void object_to_string(struct arena *arena, struct unja_object *obj) {
+    char buf[FLOAT_FORMAT_SIZE];
+    switch (obj->type) {
+        case OBJ_STRING:
+            return;
+        case OBJ_INT:
+            *obj = make_string_object(arena, buf, sprintf(buf, "%d", obj->integer));
+            return;
+        case OBJ_FLOAT:
+            *obj = make_string_object(arena, buf, format_float(buf, obj->number));
+            return;
+        default:
+            *obj = make_string_view("", 0);
+            return;
+    }
+}
+
+int object_is_truthy(const struct unja_object *obj) {
+    switch (obj->type) {
+        case OBJ_NULL: return 0; 
+        case OBJ_STRING: return obj->length > 0 && !(obj->length == 1 && object_string(obj)[0] == '0');
+        case OBJ_INT: return obj->integer > 0;
+        case OBJ_FLOAT: return obj->number > 0;
+        case OBJ_LIST:
+        case OBJ_MAP: return obj->length > 0;
+    }
+
+    return 0;
+}
+
+int object_string_equals(const struct unja_object *left, const struct unja_object *right) {
+    return left->length == right->length && memcmp(object_string(left), object_string(right), left->length) == 0;
+}
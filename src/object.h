@@ -0,0 +1,55 @@
+#include <stddef.h>
+
+struct arena;
+
+enum unja_object_type {
+    OBJ_NULL,
+    OBJ_INT,
+    OBJ_FLOAT,
+    OBJ_STRING,
+    OBJ_LIST,       /* list or map, only their number of items (in length) is known to expressions */
+    OBJ_MAP,
+};
+
+/* how a string object holds its characters */
+enum string_storage {
+    STR_BORROWED, /* points into template text or context data, must not be modified */
+    STR_INLINE,   /* short string stored in the object itself */
+    STR_OWNED,    /* allocated from the render arena, may be modified in place */
+};
+
+#define OBJECT_INLINE_SIZE 16
+
+/* value produced while evaluating an expression. strings are not necessarily NUL-terminated. */
+struct unja_object {
+    enum unja_object_type type;
+    enum string_storage storage;
+    int integer;
+    double number;
+    size_t length;
+    char *string;
+    char small[OBJECT_INLINE_SIZE];
+
+    /* strings only: whether it is markup that is output without escaping, see the safe filter */
+    int safe;
+};
+
+extern const struct unja_object null_object;
+
+/* enough for any float formatted by format_float() */
+#define FLOAT_FORMAT_SIZE 32
+
+struct unja_object make_int_object(int value);
+struct unja_object make_float_object(double value);
+struct unja_object make_collection_object(enum unja_object_type type, size_t length);
+struct unja_object make_string_view(const char *str, size_t length);
+struct unja_object make_string_object(struct arena *arena, const char *str, size_t length);
+struct unja_object concat_objects(struct arena *arena, const struct unja_object *left, const struct unja_object *right);
+const char *object_string(const struct unja_object *obj);
+char *object_mutable_string(struct arena *arena, struct unja_object *obj);
+int object_to_int(const struct unja_object *obj);
+double object_to_float(const struct unja_object *obj);
+void object_to_string(struct arena *arena, struct unja_object *obj);
+size_t format_float(char *buf, double value);
+int object_is_truthy(const struct unja_object *obj);
+int object_string_equals(const struct unja_object *left, const struct unja_object *right);
@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <err.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "parser.h"
+
+#define NODE_CHUNK_SIZE 128
+
+struct node_chunk {
+    struct node nodes[NODE_CHUNK_SIZE];
+    int size;
+    struct node_chunk *next;
+};
+
+struct parser {
+    const char *src;
+    int len;
+    int pos;
+    struct ast *ast;
+    struct parse_error *error;
+    int failed;
+
+    /* blocks parsed so far, as a template can define every block only once */
+    struct node **blocks;
+    int nblocks;
+    int blocks_cap;
+
+    /* last computed source location, so that locating nodes is linear in the source length */
+    int loc_pos;
+    int loc_line;
+    int loc_line_start;
+};
+
+static void locate(struct parser *p, int pos, int *line, int *col) {
+    if (pos < p->loc_pos) {
+        p->loc_pos = 0;
+        p->loc_line = 1;
+        p->loc_line_start = 0;
+    }
+
+    /* count the newlines between the last location and this one, a vector at a time */
+    const char *s = p->src;
+    int i = p->loc_pos;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= pos; i += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (s + i)), newline));
+        if (mask != 0) {
+            p->loc_line += __builtin_popcount(mask);
+            p->loc_line_start = i + 32 - __builtin_clz(mask);
+        }
+    }
+#endif
+    const char *nl;
+    while (i < pos && (nl = memchr(s + i, '\n', pos - i)) != NULL) {
+        p->loc_line++;
+        i = nl - s + 1;
+        p->loc_line_start = i;
+    }
+    p->loc_pos = pos;
+
+    *line = p->loc_line;
+    *col = pos - p->loc_line_start + 1;
+}
+
+static void *fail(struct parser *p, int pos, const char *format, ...) {
+    if (p->failed) {
+        return NULL;
+    }
+
+    p->failed = 1;
+    if (p->error) {
+        locate(p, pos, &p->error->line, &p->error->col);
+        va_list args;
+        va_start(args, format);
+        vsnprintf(p->error->message, sizeof p->error->message, format, args);
+        va_end(args);
+    }
+    return NULL;
+}
+
+static struct node *node_new(struct parser *p, enum node_type type, int pos) {
+    struct node_chunk *chunk = p->ast->chunks;
+    if (chunk == NULL || chunk->size == NODE_CHUNK_SIZE) {
+        chunk = malloc(sizeof *chunk);
+        if (!chunk) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+        chunk->size = 0;
+        chunk->next = p->ast->chunks;
+        p->ast->chunks = chunk;
+    }
+
+    struct node *node = &chunk->nodes[chunk->size++];
+    memset(node, 0, sizeof *node);
+    node->type = type;
+    node->pos = pos;
+    locate(p, pos, &node->line, &node->col);
+    return node;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static void skip_spaces(struct parser *p) {
+    while (is_space(p->src[p->pos])) {
+        p->pos++;
+    }
+}
+
+static int peek(struct parser *p, const char *str) {
+    return strncmp(p->src + p->pos, str, strlen(str)) == 0;
+}
+
+/* consume keyword if it is next in the input and not followed by other identifier characters */
+static int accept_keyword(struct parser *p, const char *keyword) {
+    int l = strlen(keyword);
+    if (strncmp(p->src + p->pos, keyword, l) != 0) {
+        return 0;
+    }
+
+    char next = p->src[p->pos + l];
+    if (is_alpha(next) || is_digit(next) || next == '_' || next == '.') {
+        return 0;
+    }
+
+    p->pos += l;
+    return 1;
+}
+
+/* is the input at the (optionally trimming) closing delimiter of a tag? */
+static int at_tag_close(struct parser *p) {
+    const char *s = p->src + p->pos;
+    if (*s == '-') {
+        s++;
+    }
+    return (s[0] == '%' || s[0] == '}') && s[1] == '}';
+}
+
+static struct node *parse_expression(struct parser *p);
+
+static struct node *parse_factor(struct parser *p) {
+    const char *s = p->src;
+    int start = p->pos;
+    struct node *node;
+
+    if (s[p->pos] == '"') {
+        p->pos++;
+        while (s[p->pos] != '"') {
+            if (s[p->pos] == '\0') {
+                return fail(p, start, "unterminated string");
+            }
+            p->pos++;
+        }
+
+        node = node_new(p, NODE_STRING, start + 1);
+        node->len = p->pos - start - 1;
+        p->pos++;
+        return node;
+    }
+
+    if (is_digit(s[p->pos])) {
+        int value = 0;
+        while (is_digit(s[p->pos])) {
+            value = value * 10 + (s[p->pos++] - '0');
+        }
+
+        node = node_new(p, NODE_NUMBER, start);
+        node->len = p->pos - start;
+        node->value = value;
+        return node;
+    }
+
+    if (is_alpha(s[p->pos])) {
+        while (is_alpha(s[p->pos]) || is_digit(s[p->pos]) || s[p->pos] == '_' || s[p->pos] == '.') {
+            p->pos++;
+        }
+
+        node = node_new(p, NODE_SYMBOL, start);
+        node->len = p->pos - start;
+        return node;
+    }
+
+    if (s[p->pos] == '\0') {
+        return fail(p, start, "unexpected end of input, expected expression");
+    }
+    return fail(p, start, "unexpected '%c', expected expression", s[p->pos]);
+}
+
+static struct node *binary(struct parser *p, enum binary_op op, struct node *left, struct node *right) {
+    struct node *node = node_new(p, NODE_BINARY, p->pos);
+    node->pos = left->pos;
+    node->line = left->line;
+    node->col = left->col;
+    node->value = op;
+    node->expr = left;
+    node->alt = right;
+    return node;
+}
+
+/* parse "| name" or "| name(arg, ...)" applied to expr */
+static struct node *parse_filter(struct parser *p, struct node *expr) {
+    p->pos++;
+    skip_spaces(p);
+    int start = p->pos;
+    if (!is_alpha(p->src[p->pos])) {
+        return fail(p, start, "expected filter name");
+    }
+    while (is_alpha(p->src[p->pos]) || is_digit(p->src[p->pos]) || p->src[p->pos] == '_') {
+        p->pos++;
+    }
+
+    struct node *filter = node_new(p, NODE_FILTER, start);
+    filter->len = p->pos - start;
+    filter->expr = expr;
+    if (p->src[p->pos] != '(') {
+        return filter;
+    }
+
+    p->pos++;
+    skip_spaces(p);
+    struct node **tail = &filter->alt;
+    while (p->src[p->pos] != ')') {
+        if (filter->value > 0) {
+            if (p->src[p->pos] != ',') {
+                return fail(p, p->pos, "expected ',' or ')' after filter argument");
+            }
+            p->pos++;
+            skip_spaces(p);
+        }
+
+        struct node *arg = parse_expression(p);
+        if (!arg) {
+            return NULL;
+        }
+        *tail = arg;
+        tail = &arg->next;
+        filter->value++;
+        skip_spaces(p);
+    }
+    p->pos++;
+    return filter;
+}
+
+static struct node *parse_term(struct parser *p) {
+    struct node *left = parse_factor(p);
+    if (!left) {
+        return NULL;
+    }
+
+    while (1) {
+        skip_spaces(p);
+        char c = p->src[p->pos];
+        enum binary_op op;
+        if (c == '*') {
+            op = BIN_MUL;
+        } else if (c == '/') {
+            op = BIN_DIV;
+        } else if (c == '%' && p->src[p->pos + 1] != '}') {
+            op = BIN_MOD;
+        } else {
+            break;
+        }
+
+        p->pos++;
+        skip_spaces(p);
+        struct node *right = parse_factor(p);
+        if (!right) {
+            return NULL;
+        }
+        left = binary(p, op, left, right);
+    }
+
+    /* filters apply from left to right: a | b | c is c(b(a)) */
+    while (p->src[p->pos] == '|') {
+        left = parse_filter(p, left);
+        if (!left) {
+            return NULL;
+        }
+        skip_spaces(p);
+    }
+
+    return left;
+}
+
+static struct node *parse_lexp(struct parser *p) {
+    struct node *left = parse_term(p);
+    if (!left) {
+        return NULL;
+    }
+
+    while (1) {
+        skip_spaces(p);
+        char c = p->src[p->pos];
+        enum binary_op op;
+        if (c == '+') {
+            op = BIN_ADD;
+        } else if (c == '-' && !at_tag_close(p)) {
+            op = BIN_SUB;
+        } else {
+            break;
+        }
+
+        p->pos++;
+        skip_spaces(p);
+        struct node *right = parse_term(p);
+        if (!right) {
+            return NULL;
+        }
+        left = binary(p, op, left, right);
+    }
+
+    return left;
+}
+
+static struct node *parse_expression(struct parser *p) {
+    int start = p->pos;
+    if (accept_keyword(p, "not")) {
+        skip_spaces(p);
+        struct node *node = node_new(p, NODE_NOT, start);
+        node->expr = parse_lexp(p);
+        return node->expr ? node : NULL;
+    }
+
+    struct node *left = parse_lexp(p);
+    if (!left) {
+        return NULL;
+    }
+
+    skip_spaces(p);
+    const char *s = p->src + p->pos;
+    enum binary_op op;
+    int l = 2;
+    if (s[0] == '>' && s[1] == '=') {
+        op = BIN_GTE;
+    } else if (s[0] == '<' && s[1] == '=') {
+        op = BIN_LTE;
+    } else if (s[0] == '!' && s[1] == '=') {
+        op = BIN_NEQ;
+    } else if (s[0] == '=' && s[1] == '=') {
+        op = BIN_EQ;
+    } else if (s[0] == '>') {
+        op = BIN_GT;
+        l = 1;
+    } else if (s[0] == '<') {
+        op = BIN_LT;
+        l = 1;
+    } else {
+        return left;
+    }
+
+    p->pos += l;
+    skip_spaces(p);
+    struct node *right = parse_lexp(p);
+    if (!right) {
+        return NULL;
+    }
+    return binary(p, op, left, right);
+}
+
+/* parse the opening delimiter of a tag, returns whether it has a minus sign */
+static int parse_tag_open(struct parser *p) {
+    p->pos += 2;
+    int trim = 0;
+    if (p->src[p->pos] == '-') {
+        trim = 1;
+        p->pos++;
+    }
+    skip_spaces(p);
+    return trim;
+}
+
+/* parse the closing delimiter of a tag ending in the given character, returns whether it has a minus sign */
+static int parse_tag_close(struct parser *p, char end) {
+    skip_spaces(p);
+    int trim = 0;
+    if (p->src[p->pos] == '-') {
+        trim = 1;
+        p->pos++;
+    }
+
+    if (p->src[p->pos] != end || p->src[p->pos + 1] != '}') {
+        fail(p, p->pos, "expected \"%c}\"", end);
+        return 0;
+    }
+
+    p->pos += 2;
+    return trim;
+}
+
+static int parse_name(struct parser *p, struct node *node, const char *what) {
+    skip_spaces(p);
+    int start = p->pos;
+    if (!is_alpha(p->src[p->pos])) {
+        fail(p, start, "expected %s", what);
+        return 0;
+    }
+
+    while (is_alpha(p->src[p->pos]) || is_digit(p->src[p->pos]) || p->src[p->pos] == '_' || p->src[p->pos] == '.') {
+        p->pos++;
+    }
+    node->pos = start;
+    node->len = p->pos - start;
+    return 1;
+}
+
+static struct node *parse_body(struct parser *p);
+
+/* parse a closing tag like {% endfor %} or {% else %}, setting its trim flags on node */
+static int parse_end_tag(struct parser *p, struct node *node, const char *keyword, int trim_left, int trim_right) {
+    int start = p->pos;
+    if (!peek(p, "{%")) {
+        fail(p, start, "unexpected end of input, expected {%% %s %%}", keyword);
+        return 0;
+    }
+
+    if (parse_tag_open(p)) {
+        node->trim |= trim_left;
+    }
+    if (!accept_keyword(p, keyword)) {
+        fail(p, start, "expected {%% %s %%}", keyword);
+        return 0;
+    }
+    if (parse_tag_close(p, '%')) {
+        node->trim |= trim_right;
+    }
+    return !p->failed;
+}
+
+/* parse what a for loop iterates over: a variable or range(n) */
+static struct node *parse_iterable(struct parser *p) {
+    int start = p->pos;
+    if (accept_keyword(p, "range")) {
+        skip_spaces(p);
+        if (p->src[p->pos] == '(') {
+            struct node *node = node_new(p, NODE_RANGE, start);
+            p->pos++;
+            skip_spaces(p);
+            if (!(node->expr = parse_expression(p))) {
+                return NULL;
+            }
+            skip_spaces(p);
+            if (p->src[p->pos] != ')') {
+                return fail(p, p->pos, "expected \")\"");
+            }
+            p->pos++;
+            return node;
+        }
+
+        /* just a variable named range */
+        p->pos = start;
+    }
+
+    struct node *node = node_new(p, NODE_SYMBOL, start);
+    return parse_name(p, node, "variable to iterate over") ? node : NULL;
+}
+
+static struct node *parse_statement(struct parser *p) {
+    int start = p->pos;
+    int trim = parse_tag_open(p) ? TRIM_OPEN_LEFT : 0;
+    int keyword = p->pos;
+    struct node *node;
+
+    if (accept_keyword(p, "for")) {
+        node = node_new(p, NODE_FOR, start);
+        if (!parse_name(p, node, "loop variable")) {
+            return NULL;
+        }
+        skip_spaces(p);
+        if (!accept_keyword(p, "in")) {
+            return fail(p, p->pos, "expected \"in\"");
+        }
+        skip_spaces(p);
+        if (!(node->expr = parse_iterable(p))) {
+            return NULL;
+        }
+        node->trim = trim;
+        if (parse_tag_close(p, '%')) {
+            node->trim |= TRIM_OPEN_RIGHT;
+        }
+        node->body = parse_body(p);
+        if (!parse_end_tag(p, node, "endfor", TRIM_END_LEFT, TRIM_END_RIGHT)) {
+            return NULL;
+        }
+        return node;
+    }
+
+    if (accept_keyword(p, "if")) {
+        node = node_new(p, NODE_IF, start);
+        skip_spaces(p);
+        node->expr = parse_expression(p);
+        if (!node->expr) {
+            return NULL;
+        }
+        node->trim = trim;
+        if (parse_tag_close(p, '%')) {
+            node->trim |= TRIM_OPEN_RIGHT;
+        }
+        node->body = parse_body(p);
+        if (p->failed) {
+            return NULL;
+        }
+
+        /* peek at the keyword of the tag that ended the body */
+        int end = p->pos;
+        if (peek(p, "{%")) {
+            parse_tag_open(p);
+            int has_else = accept_keyword(p, "else");
+            p->pos = end;
+            if (has_else) {
+                node->value = 1;
+                if (!parse_end_tag(p, node, "else", TRIM_ELSE_LEFT, TRIM_ELSE_RIGHT)) {
+                    return NULL;
+                }
+                node->alt = parse_body(p);
+            }
+        }
+
+        if (!parse_end_tag(p, node, "endif", TRIM_END_LEFT, TRIM_END_RIGHT)) {
+            return NULL;
+        }
+        return node;
+    }
+
+    if (accept_keyword(p, "block")) {
+        node = node_new(p, NODE_BLOCK, start);
+        if (!parse_name(p, node, "block name")) {
+            return NULL;
+        }
+        for (int i=0; i < p->nblocks; i++) {
+            if (p->blocks[i]->len == node->len && memcmp(p->src + p->blocks[i]->pos, p->src + node->pos, node->len) == 0) {
+                return fail(p, node->pos, "block \"%.*s\" defined twice", node->len, p->src + node->pos);
+            }
+        }
+        if (p->nblocks == p->blocks_cap) {
+            p->blocks_cap = p->blocks_cap ? p->blocks_cap * 2 : 8;
+            p->blocks = realloc(p->blocks, p->blocks_cap * sizeof *p->blocks);
+            if (!p->blocks) {
+                errx(EXIT_FAILURE, "out of memory");
+            }
+        }
+        p->blocks[p->nblocks++] = node;
+        node->trim = trim;
+        if (parse_tag_close(p, '%')) {
+            node->trim |= TRIM_OPEN_RIGHT;
+        }
+        node->body = parse_body(p);
+        if (!parse_end_tag(p, node, "endblock", TRIM_END_LEFT, TRIM_END_RIGHT)) {
+            return NULL;
+        }
+        return node;
+    }
+
+    if (accept_keyword(p, "extends")) {
+        node = node_new(p, NODE_EXTENDS, start);
+        skip_spaces(p);
+        struct node *name = parse_factor(p);
+        if (!name) {
+            return NULL;
+        }
+        if (name->type != NODE_STRING) {
+            return fail(p, name->pos, "expected template name as string");
+        }
+        node->pos = name->pos;
+        node->len = name->len;
+        node->trim = trim;
+        if (parse_tag_close(p, '%')) {
+            node->trim |= TRIM_OPEN_RIGHT;
+        }
+        return node;
+    }
+
+    return fail(p, keyword, "unknown tag");
+}
+
+/* is the input at a tag that ends the current body? */
+static int at_end_tag(struct parser *p) {
+    int start = p->pos;
+    parse_tag_open(p);
+    int end = accept_keyword(p, "endfor") || accept_keyword(p, "endif") || accept_keyword(p, "else") || accept_keyword(p, "endblock");
+    p->pos = start;
+    return end;
+}
+
+/* position of the first tag ({{, {% or {#) at or after pos, or the end of the source */
+static int next_tag(struct parser *p, int pos) {
+    const char *s = p->src;
+#ifdef __SSE2__
+    /* the character after every position is compared as well, so vectors stop one short of the end */
+    const __m128i brace = _mm_set1_epi8('{');
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i hash = _mm_set1_epi8('#');
+    for (; pos + 17 <= p->len; pos += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *) (s + pos));
+        __m128i next = _mm_loadu_si128((const __m128i *) (s + pos + 1));
+        __m128i open = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(next, brace), _mm_cmpeq_epi8(next, percent)), _mm_cmpeq_epi8(next, hash));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(c, brace), open));
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    const char *brace_at;
+    while (pos < p->len && (brace_at = memchr(s + pos, '{', p->len - pos)) != NULL) {
+        pos = brace_at - s;
+        if (s[pos + 1] == '{' || s[pos + 1] == '%' || s[pos + 1] == '#') {
+            return pos;
+        }
+        pos++;
+    }
+    return p->len;
+}
+
+/* parse a list of statements, up to the end of input or a tag ending the enclosing statement */
+static struct node *parse_body(struct parser *p) {
+    struct node *head = NULL;
+    struct node **tail = &head;
+    const char *s = p->src;
+
+    while (!p->failed && s[p->pos] != '\0') {
+        int start = p->pos;
+        struct node *node = NULL;
+
+        if (s[p->pos] == '{' && s[p->pos + 1] == '{') {
+            node = node_new(p, NODE_PRINT, start);
+            if (parse_tag_open(p)) {
+                node->trim |= TRIM_OPEN_LEFT;
+            }
+            node->expr = parse_expression(p);
+            if (!node->expr) {
+                return NULL;
+            }
+            if (parse_tag_close(p, '}')) {
+                node->trim |= TRIM_OPEN_RIGHT;
+            }
+        } else if (s[p->pos] == '{' && s[p->pos + 1] == '#') {
+            const char *end = strstr(s + p->pos + 2, "#}");
+            if (!end) {
+                return fail(p, start, "unterminated comment");
+            }
+            p->pos = end - s + 2;
+            continue;
+        } else if (s[p->pos] == '{' && s[p->pos + 1] == '%') {
+            if (at_end_tag(p)) {
+                break;
+            }
+            node = parse_statement(p);
+        } else {
+            /* text runs up to the next tag */
+            int end = next_tag(p, p->pos + 1);
+            node = node_new(p, NODE_TEXT, start);
+            node->len = end - start;
+            p->pos = end;
+        }
+
+        if (!node) {
+            return NULL;
+        }
+        *tail = node;
+        tail = &node->next;
+    }
+
+    return head;
+}
+
+/* parse template source into a tree of nodes. source must outlive the returned tree. */
+struct ast *parse(const char *source, struct parse_error *error) {
+    struct ast *ast = malloc(sizeof *ast);
+    if (!ast) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    ast->source = source;
+    ast->chunks = NULL;
+
+    struct parser p = {
+        .src = source,
+        .len = strlen(source),
+        .pos = 0,
+        .ast = ast,
+        .error = error,
+        .failed = 0,
+        .blocks = NULL,
+        .nblocks = 0,
+        .blocks_cap = 0,
+        .loc_pos = 0,
+        .loc_line = 1,
+        .loc_line_start = 0,
+    };
+    ast->root = parse_body(&p);
+
+    if (!p.failed && source[p.pos] != '\0') {
+        int start = p.pos;
+        parse_tag_open(&p);
+        int keyword = p.pos;
+        while (is_alpha(source[p.pos])) {
+            p.pos++;
+        }
+        fail(&p, start, "unexpected {%% %.*s %%}", p.pos - keyword, source + keyword);
+    }
+    free(p.blocks);
+
+    if (p.failed) {
+        ast_free(ast);
+        return NULL;
+    }
+
+    return ast;
+}
+
+void ast_free(struct ast *ast) {
+    struct node_chunk *chunk = ast->chunks;
+    while (chunk) {
+        struct node_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(ast);
+}
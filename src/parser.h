@@ -0,0 +1,91 @@
+enum node_type {
+    NODE_TEXT,
+    NODE_PRINT,
+    NODE_FOR,
+    NODE_IF,
+    NODE_BLOCK,
+    NODE_EXTENDS,
+
+    /* expressions */
+    NODE_SYMBOL,
+    NODE_NUMBER,
+    NODE_STRING,
+    NODE_NOT,
+    NODE_BINARY,
+    NODE_FILTER,
+    NODE_RANGE,
+};
+
+/* whitespace control flags: a minus sign on the inner side of a tag delimiter */
+enum {
+    TRIM_OPEN_LEFT = 1 << 0,  /* {%- for ... */
+    TRIM_OPEN_RIGHT = 1 << 1, /* for ... -%} */
+    TRIM_ELSE_LEFT = 1 << 2,
+    TRIM_ELSE_RIGHT = 1 << 3,
+    TRIM_END_LEFT = 1 << 4,   /* {%- endfor */
+    TRIM_END_RIGHT = 1 << 5,  /* endfor -%} */
+};
+
+enum binary_op {
+    BIN_ADD,
+    BIN_SUB,
+    BIN_MUL,
+    BIN_DIV,
+    BIN_MOD,
+    BIN_GT,
+    BIN_GTE,
+    BIN_LT,
+    BIN_LTE,
+    BIN_EQ,
+    BIN_NEQ,
+};
+
+/*
+ * Node of a parsed template. Names and text are not copied, but referenced by their position in the source.
+ *
+ * NODE_TEXT     pos, len: text
+ * NODE_PRINT    expr: expression to print
+ * NODE_FOR      pos, len: loop variable, expr: iterable (symbol or range), body: loop body
+ * NODE_IF       expr: condition, body, alt: else body, value: 1 if there is an else tag
+ * NODE_BLOCK    pos, len: block name, body
+ * NODE_EXTENDS  pos, len: name of parent template
+ * NODE_SYMBOL   pos, len: (dotted) variable name
+ * NODE_NUMBER   value
+ * NODE_STRING   pos, len: string contents without quotes
+ * NODE_NOT      expr: negated expression
+ * NODE_BINARY   value: binary_op, expr: left operand, alt: right operand
+ * NODE_FILTER   pos, len: filter name, expr: filtered expression, alt: arguments linked by next, value: number of arguments
+ * NODE_RANGE    expr: number of items of range(n)
+ */
+struct node {
+    enum node_type type;
+    int line;
+    int col;
+    int pos;
+    int len;
+    int value;
+    int trim;
+    struct node *expr;
+    struct node *body;
+    struct node *alt;
+
+    /* next sibling in a list of statements or filter arguments */
+    struct node *next;
+};
+
+struct parse_error {
+    int line;
+    int col;
+    char message[128];
+};
+
+struct ast {
+    const char *source;
+    struct node *root;
+
+    /* nodes are allocated in chunks which are freed at once */
+    struct node_chunk *chunks;
+};
+
+struct ast *parse(const char *source, struct parse_error *error);
+void ast_free(struct ast *ast);
@@ -0,0 +1,280 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <err.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "template.h"
+#include "program.h"
+#include "profile.h"
+
+/* line, loop or block of a template, or a folded stack of them */
+struct profile_node {
+    char *name;
+
+    /* number of times it was executed */
+    uint64_t count;
+
+    /* time spent in its own instructions, and in those of the loops and blocks it contains */
+    uint64_t self_ns;
+    uint64_t total_ns;
+
+    /* most executions of a single instruction of a line in the render being added, as that is how often the line ran */
+    int render;
+    uint64_t render_count;
+};
+
+struct profile {
+    pthread_mutex_t lock;
+    int renders;
+    uint64_t ns;
+
+    /* nodes and folded stacks by name */
+    struct hashmap *nodes;
+    struct hashmap *stacks;
+};
+
+/* growing string */
+struct text {
+    char *data;
+    size_t size;
+    size_t cap;
+};
+
+struct profile *profile_new() {
+    struct profile *profile = malloc(sizeof *profile);
+    if (!profile) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    pthread_mutex_init(&profile->lock, NULL);
+    profile->renders = 0;
+    profile->ns = 0;
+    profile->nodes = hashmap_new();
+    profile->stacks = hashmap_new();
+    return profile;
+}
+
+static void node_free(void *node) {
+    free(((struct profile_node *) node)->name);
+    free(node);
+}
+
+void profile_free(struct profile *profile) {
+    hashmap_walk(profile->nodes, node_free);
+    hashmap_free(profile->nodes);
+    hashmap_walk(profile->stacks, node_free);
+    hashmap_free(profile->stacks);
+    pthread_mutex_destroy(&profile->lock);
+    free(profile);
+}
+
+/* stop timing the current instruction and start timing instruction pc, or stop timing if pc is -1 */
+void profile_tick(struct profile_sample *sample, int pc) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    if (sample->pc >= 0) {
+        sample->ns[sample->pc] += now - sample->start;
+    }
+    if (pc >= 0) {
+        sample->counts[pc]++;
+    }
+    sample->pc = pc;
+    sample->start = now;
+}
+
+static struct text text_new() {
+    struct text t;
+    t.size = 0;
+    t.cap = 64;
+    t.data = malloc(t.cap);
+    if (!t.data) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    t.data[0] = '\0';
+    return t;
+}
+
+static void text_printf(struct text *t, const char *format, ...) {
+    va_list args;
+    while (1) {
+        va_start(args, format);
+        int n = vsnprintf(t->data + t->size, t->cap - t->size, format, args);
+        va_end(args);
+        if (t->size + n < t->cap) {
+            t->size += n;
+            return;
+        }
+
+        t->cap = (t->size + n + 1) * 2;
+        t->data = realloc(t->data, t->cap);
+        if (!t->data) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+    }
+}
+
+static void text_truncate(struct text *t, size_t size) {
+    t->size = size;
+    t->data[size] = '\0';
+}
+
+static struct profile_node *get_node(struct hashmap *nodes, const char *name) {
+    struct profile_node *node = hashmap_get(nodes, (char *) name);
+    if (node) {
+        return node;
+    }
+
+    node = calloc(1, sizeof *node);
+    size_t l = strlen(name);
+    if (!node || !(node->name = malloc(l + 1))) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    memcpy(node->name, name, l + 1);
+    node->render = -1;
+    hashmap_insert(nodes, node->name, node);
+    return node;
+}
+
+/* loop or block enclosing the instructions up to end */
+struct frame {
+    struct profile_node *node;
+    int end;
+
+    /* length of the folded stack up to and including this frame */
+    size_t stack_size;
+};
+
+/* add a render of the linked program of a template to the profile */
+void profile_add(struct profile *profile, const char *template_name, struct program *prog, struct profile_sample *sample) {
+    /* loops and blocks nest, so no more of them can be open than there are instructions */
+    struct frame *frames = malloc((prog->size + 1) * sizeof *frames);
+    if (!frames) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    struct text name = text_new();
+    struct text stack = text_new();
+    uint64_t total = 0;
+
+    pthread_mutex_lock(&profile->lock);
+    int render = profile->renders++;
+    struct profile_node *root = get_node(profile->nodes, template_name);
+    root->count++;
+    text_printf(&stack, "%s", template_name);
+    frames[0] = (struct frame) { root, prog->size, stack.size };
+    int depth = 0;
+
+    for (int pc=0; pc < prog->size; pc++) {
+        while (frames[depth].end <= pc) {
+            text_truncate(&stack, frames[--depth].stack_size);
+        }
+
+        /* instructions of loops and blocks that did not run did not run either, so they are skipped as well */
+        uint64_t count = sample->counts[pc];
+        if (count == 0) {
+            continue;
+        }
+
+        struct instr *ins = &prog->code[pc];
+        struct source_pos *pos = &prog->positions[pc];
+        const char *source = pos->name >= 0 ? prog->strings + pos->name : template_name;
+        if (ins->op == OP_BLOCK || ins->op == OP_FOR_BEGIN || ins->op == OP_FOR_RANGE) {
+            text_truncate(&name, 0);
+            text_printf(&name, "%s:%d %s %s", source, pos->line, ins->op == OP_BLOCK ? "block" : "for", prog->strings + ins->a);
+            struct profile_node *node = get_node(profile->nodes, name.data);
+            node->count += count;
+            text_printf(&stack, ";%s", name.data);
+            frames[++depth] = (struct frame) { node, ins->c, stack.size };
+        }
+
+        uint64_t ns = sample->ns[pc];
+        total += ns;
+        for (int i=0; i <= depth; i++) {
+            frames[i].node->total_ns += ns;
+        }
+        frames[depth].node->self_ns += ns;
+
+        text_truncate(&name, 0);
+        text_printf(&name, "%s:%d", source, pos->line);
+        struct profile_node *line = get_node(profile->nodes, name.data);
+        if (line->render != render) {
+            line->render = render;
+            line->render_count = 0;
+        }
+        if (count > line->render_count) {
+            line->count += count - line->render_count;
+            line->render_count = count;
+        }
+        line->self_ns += ns;
+        line->total_ns += ns;
+
+        size_t stack_size = stack.size;
+        text_printf(&stack, ";%s", name.data);
+        get_node(profile->stacks, stack.data)->self_ns += ns;
+        text_truncate(&stack, stack_size);
+    }
+
+    profile->ns += total;
+    pthread_mutex_unlock(&profile->lock);
+    free(frames);
+    free(name.data);
+    free(stack.data);
+}
+
+/* nodes of a map as an array, sorted by cmp */
+static struct profile_node **sorted(struct hashmap *nodes, int (*cmp)(const void *, const void *)) {
+    struct profile_node **list = malloc((nodes->size + 1) * sizeof *list);
+    if (!list) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    size_t n = 0;
+    for (size_t i=0; i < nodes->cap; i++) {
+        if (nodes->entries[i].key != NULL) {
+            list[n++] = nodes->entries[i].value;
+        }
+    }
+    qsort(list, n, sizeof *list, cmp);
+    return list;
+}
+
+static int by_total(const void *a, const void *b) {
+    const struct profile_node *x = *(struct profile_node **) a;
+    const struct profile_node *y = *(struct profile_node **) b;
+    if (x->total_ns != y->total_ns) {
+        return x->total_ns < y->total_ns ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp((*(struct profile_node **) a)->name, (*(struct profile_node **) b)->name);
+}
+
+/* write a table of all templates, lines, loops and blocks that ran, most time spent in them first */
+void profile_report(struct profile *profile, FILE *f) {
+    pthread_mutex_lock(&profile->lock);
+    struct profile_node **nodes = sorted(profile->nodes, by_total);
+    fprintf(f, "%d renders in %.3f ms\n\n", profile->renders, profile->ns / 1e6);
+    fprintf(f, "%12s %12s %7s %10s  %s\n", "total ms", "self ms", "total%", "count", "node");
+    for (size_t i=0; i < profile->nodes->size; i++) {
+        struct profile_node *node = nodes[i];
+        fprintf(f, "%12.3f %12.3f %6.1f%% %10llu  %s\n", node->total_ns / 1e6, node->self_ns / 1e6,
+            profile->ns > 0 ? 100.0 * node->total_ns / profile->ns : 0.0, (unsigned long long) node->count, node->name);
+    }
+    pthread_mutex_unlock(&profile->lock);
+    free(nodes);
+}
+
+/* write time spent in nanoseconds by stack of template, blocks, loops and line, in the folded format read by flamegraph.pl */
+void profile_write_folded(struct profile *profile, FILE *f) {
+    pthread_mutex_lock(&profile->lock);
+    struct profile_node **stacks = sorted(profile->stacks, by_name);
+    for (size_t i=0; i < profile->stacks->size; i++) {
+        fprintf(f, "%s %llu\n", stacks[i]->name, (unsigned long long) stacks[i]->self_ns);
+    }
+    pthread_mutex_unlock(&profile->lock);
+    free(stacks);
+}
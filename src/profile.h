@@ -0,0 +1,21 @@
+/*
+ * A profiled render counts and times every instruction it executes, then adds them to the profile
+ * by the source position of the instructions and the loops and blocks they are in.
+ * Include after program.h.
+ */
+#include <stdint.h>
+
+struct profile;
+
+/* executions and nanoseconds spent per instruction of a single render */
+struct profile_sample {
+    uint64_t *counts;
+    uint64_t *ns;
+
+    /* instruction being timed, or -1, and when it started */
+    int pc;
+    uint64_t start;
+};
+
+void profile_tick(struct profile_sample *sample, int pc);
+void profile_add(struct profile *profile, const char *template_name, struct program *prog, struct profile_sample *sample);
@@ -0,0 +1,105 @@
+/*
+ * A compiled template is a flat array of instructions executed by a small stack machine.
+ * Expressions are lowered to postfix form, control flow to (conditional) jumps.
+ * Strings referenced by instructions live in a per-program string pool and are addressed by offset.
+ */
+enum opcode {
+    OP_TEXT,        /* output static text at a with length b, c = 1 if text was already trimmed at compile time */
+    OP_PRINT,       /* pop value and output it */
+    OP_PUSH_INT,    /* push integer a */
+    OP_PUSH_STRING, /* push string at a with length b */
+    OP_LOAD,        /* push variable named by the path starting at segment a */
+    OP_LOAD_LOCAL,  /* push variable named by the path starting at segment a, which starts at the variable of the b-th enclosing loop (0 being the innermost) */
+    OP_LOOP_FIELD,  /* push field a of the innermost loop (enum loop_field) as an integer */
+    OP_FILTER,      /* apply filter named at a to the value below the c arguments on top of the stack, popping the arguments. b numbers the filters of a program from 0 */
+    OP_NOT,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_GT,
+    OP_GTE,
+    OP_LT,
+    OP_LTE,
+    OP_EQ,
+    OP_NEQ,
+    OP_JMP,         /* jump to a */
+    OP_JMP_FALSE,   /* pop value, jump to a if it is falsy */
+    OP_FOR_BEGIN,   /* start loop over list named by the path starting at segment b, binding items to name at a. jump to c if list is empty */
+    OP_FOR_NEXT,    /* advance innermost loop, jump back to a if there are items left */
+    OP_FOR_RANGE,   /* pop count, start loop over the numbers 0 to count - 1, binding them to name at a. jump to c if count is not positive */
+    OP_BLOCK,       /* block named at a. body follows, c is the first instruction after it. when linking, the default body is replaced by the winning one */
+    OP_SET_TRIM,    /* set whether leading whitespace of the next text should be trimmed to a */
+    OP_RTRIM,       /* trim trailing whitespace from output */
+    OP_HALT,
+};
+
+/* fields of the "loop" variable */
+enum loop_field {
+    LOOP_INDEX,
+    LOOP_FIRST,
+    LOOP_LAST,
+};
+
+struct instr {
+    enum opcode op;
+    int a;
+    int b;
+    int c;
+};
+
+/* part of a dotted variable name, split and hashed at compile time. a path is a run of segments ending at the one marked last. */
+struct segment {
+    int name;
+    int length;
+    unsigned int hash;
+    int last;
+};
+
+/* where an instruction came from: a line in the template named at pool offset name, or in the program's own template if name is -1 */
+struct source_pos {
+    int name;
+    int line;
+};
+
+struct program {
+    struct instr *code;
+    int size;
+    int cap;
+
+    /* source position of every instruction, used for profiling */
+    struct source_pos *positions;
+
+    /* pool of NUL-terminated strings referenced by instructions */
+    char *strings;
+    int strings_size;
+    int strings_cap;
+
+    /* segments of all variable names */
+    struct segment *segments;
+    int segments_size;
+    int segments_cap;
+
+    /* position of the first instruction of each block's body, by block name */
+    struct hashmap *blocks;
+
+    /* name of the template this template extends, or NULL */
+    char *parent;
+
+    /* whether code, positions, strings and segments point into a cache file instead of being owned by the program */
+    int mapped;
+};
+
+struct ast;
+
+struct block {
+    int start;
+    int end;
+};
+
+struct program *compile(struct ast *ast);
+struct program *program_link(struct program **chain, int n);
+size_t program_size(struct program *prog);
+size_t program_blocks_size(struct program *prog);
+void program_free(struct program *prog);
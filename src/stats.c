@@ -0,0 +1,3 @@
+#include "stats.h"
+
+__thread struct alloc_counter alloc_counter;
@@ -0,0 +1,17 @@
+/*
+ * Heap allocations made by unja, counted per thread. A render that collects stats compares
+ * the counters before and after, as everything it allocates is allocated on its own thread.
+ */
+#include <stddef.h>
+
+struct alloc_counter {
+    size_t allocations;
+    size_t bytes;
+};
+
+extern __thread struct alloc_counter alloc_counter;
+
+static inline void count_alloc(size_t bytes) {
+    alloc_counter.allocations++;
+    alloc_counter.bytes += bytes;
+}
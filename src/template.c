@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <err.h>
@@ -5,47 +6,118 @@
 #include <dirent.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sched.h>
 
-#include "vendor/mpc.h"
 #include "template.h"
+#include "parser.h"
+#include "program.h"
+#include "arena.h"
+#include "object.h"
+#include "watch.h"
+#include "cache.h"
+#include "compiled.h"
+#include "stats.h"
+#include "profile.h"
+#include "escape.h"
 
-enum unja_object_type {
-    OBJ_NULL,
-    OBJ_INT,
-    OBJ_STRING,
-};
-
-struct unja_object {
-    enum unja_object_type type;
-    int integer;
+struct buffer {
+    size_t size;
+    size_t cap;
     char *string;
-    char *string_ptr;
-};
 
-struct unja_object null_object = { 
-    .type = OBJ_NULL,
+    /* if set, output is written to sink in chunks instead of being kept in memory */
+    struct sink *sink;
+    int error;
+
+    /* if set, output is collected as segments referencing template text instead */
+    struct iov_output *iov;
+
+    /* number of times the buffer had to grow */
+    size_t reallocs;
 };
 
-struct buffer {
-    int size;
-    int cap;
-    char *string;
+/* chunk of scratch memory holding the dynamic parts of an iov_output */
+struct scratch {
+    struct scratch *next;
+    size_t size;
+    size_t cap;
+    char data[];
 };
 
+#define SCRATCH_CHUNK_SIZE 4096
+
+#define SINK_CHUNK_SIZE 8192
+#define ESCAPE_CHUNK_SIZE 1024
+#define RENDER_ARENA_SIZE 4096
+#define MAX_INHERITANCE_DEPTH 32
+#define MAX_LOAD_THREADS 64
+
 struct env {
+    /* 
+     * all templates by name. the map itself is never modified once published, only lazily loaded templates are.
+     * env_reload() publishes a new map and frees the old one once no render can be using it anymore.
+     */
     struct hashmap *templates;
+    char *dirname;
+    int recursive;
+
+    /* whether strings are escaped for HTML when they are output, unless they are marked safe */
+    int autoescape;
+
+    /* filters added to the builtin ones, see env_options */
+    struct unja_filter *filters;
+    int nfilters;
+
+    /* renders in progress, counted in one of two slots depending on the epoch in which they started */
+    unsigned int epoch;
+    int readers[2];
+    pthread_mutex_t reload_lock;
+    struct watcher *watcher;
+
+    /* mapped cache file of compiled templates, or NULL */
+    struct cache *cache;
+
+    /* lazy mode: templates are compiled on first use and kept in a cache of at most cache_size bytes */
+    int lazy;
+    size_t cache_size;
+    size_t cache_used;
+    pthread_mutex_t lock;
+
+    /* compiled templates, most recently used first */
+    struct template *lru_head;
+    struct template *lru_tail;
 };
 
 struct template {
     char *name;
-    mpc_ast_t *ast;
-    struct hashmap *blocks;
-    char *parent;
+    struct program *program;
+
+    /* program with all ancestors and block overrides linked in, or NULL if a parent is missing */
+    struct program *linked;
+
+    /* filter applied by every OP_FILTER of the linked program, by its number. NULL for unknown filters. */
+    const struct unja_filter **filters;
+
+    /* modification time in nanoseconds and size of the source file when it was loaded */
+    int64_t mtime_ns;
+    int64_t source_size;
+
+    /* lazy mode only: number of renders using the template, bytes used by its programs and its place in the cache */
+    int refs;
+    size_t size;
+    struct template *lru_prev;
+    struct template *lru_next;
 };
 
 /* ensure buffer has room for a string sized l, grows buffer capacity if needed */
-void buffer_reserve(struct buffer *buf, int l) {
-    int req_size = buf->size + l;
+void buffer_reserve(struct buffer *buf, size_t l) {
+    size_t req_size = buf->size + l;
     if (req_size >= buf->cap) {
         while (req_size >= buf->cap) {
             buf->cap *= 2;
@@ -55,688 +127,2071 @@ void buffer_reserve(struct buffer *buf, int l) {
         if (!buf->string) {
             errx(EXIT_FAILURE, "out of memory");
         }
+        count_alloc(buf->cap * sizeof *buf->string);
+        buf->reallocs++;
     }
 }
 
-
-mpc_parser_t *parser_init() {
-    static mpc_parser_t *template;
-    if (template != NULL) {
-        return template;
-    }
-
-    mpc_parser_t *spaces = mpc_new("spaces");
-    mpc_parser_t *symbol = mpc_new("symbol");
-    mpc_parser_t *number = mpc_new("number");
-    mpc_parser_t *string = mpc_new("string");
-    mpc_parser_t *text = mpc_new("text");
-    mpc_parser_t *print = mpc_new("print");
-    mpc_parser_t *lexp = mpc_new("lexp");
-    mpc_parser_t *exp = mpc_new("expression");
-    mpc_parser_t *comment = mpc_new("comment");
-    mpc_parser_t *statement = mpc_new("statement");
-    mpc_parser_t *statement_open = mpc_new("statement_open");
-    mpc_parser_t *statement_close = mpc_new("statement_close");
-    mpc_parser_t *statement_for = mpc_new("for");
-    mpc_parser_t *statement_if = mpc_new("if");
-    mpc_parser_t *statement_block = mpc_new("block");
-    mpc_parser_t *statement_extends = mpc_new("extends");
-    mpc_parser_t *body = mpc_new("body");
-    mpc_parser_t *content = mpc_new("content");
-    mpc_parser_t *factor = mpc_new("factor");
-    mpc_parser_t *term = mpc_new("term");
-    mpc_parser_t *filter = mpc_new("filter");
-
-    template = mpc_new("template");
-    mpca_lang(MPCA_LANG_WHITESPACE_SENSITIVE,
-        " spaces    : / */ ;"
-        " symbol    : /[a-zA-Z][a-zA-Z0-9_.]*/ ;"
-        " number    : /[0-9]+/ ;"
-        " text      : /[^{][^{%#]*/;"
-        " string    : '\"' /([^\"])*/ '\"' ;"
-        " factor    : <symbol> | <number> | <string> ;"
-        " filter    : <spaces> '|' <spaces> <symbol>; "
-        " term      :  <factor> (<spaces> ('*' | '/' | '%') <spaces> <factor>)* <filter>?;"
-        " lexp      : <term> (<spaces> ('+' | '-') <spaces> <term>)* ;"
-        " expression: <lexp> <spaces> '>' <spaces> <lexp> "
-        "           | <lexp> <spaces> '<' <spaces> <lexp> "
-        "           | <lexp> <spaces> \">=\" <spaces> <lexp> "
-        "           | <lexp> <spaces> \"<=\" <spaces> <lexp> "
-        "           | <lexp> <spaces> \"!=\" <spaces> <lexp> "
-        "           | <lexp> <spaces> \"==\" <spaces> <lexp> "
-        "           | \"not\" <spaces> <lexp> "
-        "           | <lexp> ;"
-        " print     : /{{2}-? */ <expression> / *-?}}/ ;"
-        " comment   : \"{#\" /[^#][^#}]*/ \"#}\" ;"
-        " statement_open: /{\%-? */;"
-        " statement_close: / *-?\%}/;"
-        " for       : <statement_open> \"for \" <symbol> \" in \" <symbol> <statement_close> <body> <statement_open> \"endfor\" <statement_close> ;"
-        " block     : <statement_open> \"block \" <symbol> <statement_close> <body> <statement_open> \"endblock\" <statement_close>;"
-        " extends   : <statement_open> \"extends \" <string> <statement_close>;"
-        " if        : <statement_open> \"if \" <expression> <statement_close> <body> (<statement_open> \"else\" <statement_close> <body>)? <statement_open> \"endif\" <statement_close> ;"
-        " statement : <for> | <block> | <extends> | <if> ;"
-        " content   : <print> | <statement> | <text> | <comment>;"
-        " body      : <content>* ;"
-        " template  : /^/ <body> /$/ ;",
-        spaces,
-        filter,
-        factor, 
-        term,
-        symbol, 
-        text,
-        number,
-        string,
-        print,
-        lexp,
-        exp, 
-        comment,
-        statement_open, 
-        statement_close, 
-        statement,
-        statement_if,
-        statement_for, 
-        statement_block,
-        statement_extends,
-        content, 
-        body, 
-        template);
-
-    return template;
-}
-
-mpc_ast_t *parse(char *tmpl) {
-    mpc_parser_t *parser = parser_init();
-    mpc_result_t r;
-
-    if (!mpc_parse("input", tmpl, parser, &r)) {
-        puts(tmpl);
-        mpc_err_print(r.error);
-        mpc_err_delete(r.error);
-        return NULL;
+static void sink_write(struct buffer *buf, const char *str, size_t l) {
+    if (!buf->error && l > 0 && buf->sink->write(str, l, buf->sink->data) != 0) {
+        buf->error = 1;
     }
-
-    return r.output;
 }
 
-struct hashmap *find_blocks_in_ast(mpc_ast_t *node, struct hashmap *map) {
-    if (strstr(node->tag, "content|statement|block")) {
-        char *name = node->children[2]->contents;
-        hashmap_insert(map, name, node);
+/* length of str without its trailing whitespace */
+static size_t rtrimmed_length(const char *str, size_t l) {
+    while (l > 0 && isspace(str[l-1])) {
+        l--;
     }
+    return l;
+}
 
-    for (int i=0; i < node->children_num; i++) {
-        find_blocks_in_ast(node->children[i], map);
+/* 
+ * Append string of length l to buffer. 
+ * When writing to a sink, everything but trailing whitespace is flushed once a chunk is full;
+ * the whitespace is held back because a later {%- tag may still trim it.
+ */
+void buffer_append(struct buffer *buf, const char *str, size_t l) {
+    if (buf->sink && buf->size + l >= SINK_CHUNK_SIZE) {
+        size_t keep = rtrimmed_length(str, l);
+        if (keep > 0) {
+            sink_write(buf, buf->string, buf->size);
+            sink_write(buf, str, keep);
+            buf->size = 0;
+            str += keep;
+            l -= keep;
+        }
     }
 
-    return map;
+    buffer_reserve(buf, l);
+    memcpy(buf->string + buf->size, str, l);
+    buf->size += l;
+    buf->string[buf->size] = '\0';
 }
 
-struct env *env_new(char *dirname) {
-    /* store current working dir so we can revert to it after reading templates */
-    char working_dir[256];
-    getcwd(working_dir, 255);
-
-    DIR *dr = opendir(dirname); 
-    if (dr == NULL) { 
-        errx(EXIT_FAILURE, "could not open directory \"%s\"", dirname); 
-    } 
-  
-    struct env *env = malloc(sizeof *env);
-    env->templates = hashmap_new();
-    chdir(dirname);
-
-    struct dirent *de;   
-    while ((de = readdir(dr)) != NULL) {
-        // skip files starting with a dot
-        if (de->d_name[0] == '.') {
-            continue;
+static struct iovec *iov_push(struct iov_output *out, const char *str, size_t l) {
+    if (out->iovcnt == out->iov_cap) {
+        out->iov_cap = out->iov_cap ? out->iov_cap * 2 : 64;
+        out->iov = realloc(out->iov, out->iov_cap * sizeof *out->iov);
+        if (!out->iov) {
+            errx(EXIT_FAILURE, "out of memory");
         }
+        count_alloc(out->iov_cap * sizeof *out->iov);
+    }
 
-        // copy template name as closedir free's it otherwise
-        char *name = malloc(strlen(de->d_name) + 1);
-        strcpy(name, de->d_name);
-
-        char *tmpl = read_file(name);
-        #if DEBUG
-        printf("Parsing template from file %s: %s\n", name, tmpl);
-        #endif
-        mpc_ast_t *ast = parse(tmpl);
-        free(tmpl);
-
-        struct template *t = malloc(sizeof *t);
-        t->ast = ast;
-        t->name = name;
-        t->blocks = find_blocks_in_ast(ast, hashmap_new());
-        t->parent = NULL;
+    struct iovec *v = &out->iov[out->iovcnt++];
+    v->iov_base = (char *) str;
+    v->iov_len = l;
+    return v;
+}
 
-        if (ast->children_num > 1 && ast->children[1]->children_num > 0 && strstr(ast->children[1]->children[0]->tag, "content|statement|extends")) {
-            t->parent = ast->children[1]->children[0]->children[2]->children[1]->contents;
+/* copy string into scratch memory, extending the last segment if it ends where the copy starts */
+static void iov_copy(struct iov_output *out, const char *str, size_t l) {
+    struct scratch *chunk = out->scratch;
+    if (chunk == NULL || chunk->cap - chunk->size < l) {
+        size_t cap = l > SCRATCH_CHUNK_SIZE ? l : SCRATCH_CHUNK_SIZE;
+        chunk = malloc(sizeof *chunk + cap);
+        if (!chunk) {
+            errx(EXIT_FAILURE, "out of memory");
         }
+        count_alloc(sizeof *chunk + cap);
+        chunk->size = 0;
+        chunk->cap = cap;
+        chunk->next = out->scratch;
+        out->scratch = chunk;
+    }
 
-        hashmap_insert(env->templates, name, t);
+    char *dest = chunk->data + chunk->size;
+    memcpy(dest, str, l);
+    chunk->size += l;
+
+    struct iovec *last = out->iovcnt > 0 ? &out->iov[out->iovcnt - 1] : NULL;
+    if (last && (char *) last->iov_base + last->iov_len == dest) {
+        last->iov_len += l;
+    } else {
+        iov_push(out, dest, l);
     }
-  
-    closedir(dr); 
-    chdir(working_dir);    
-    return env;
 }
 
-void template_free(void *v) {
-    struct template *t = (struct template *)v;
-    hashmap_free(t->blocks);
-    mpc_ast_delete(t->ast);
-    free(t->name);
-    free(t);
-}
+/* append text which outlives the render, like text from the template itself */
+void buffer_append_static(struct buffer *buf, const char *str, size_t l) {
+    if (buf->iov) {
+        if (l > 0) {
+            iov_push(buf->iov, str, l);
+        }
+        return;
+    }
 
-void env_free(struct env *env) {
-    hashmap_walk(env->templates, template_free);
-    hashmap_free(env->templates);
-    free(env);
+    buffer_append(buf, str, l);
 }
 
-char *read_file(char *filename) {
-    char *input = malloc(BUFSIZ);
-    unsigned int size = 0;
-
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        errx(EXIT_FAILURE, "could not open \"%s\" for reading", filename);
+/* append text which only lives as long as the value it came from */
+void buffer_append_dynamic(struct buffer *buf, const char *str, size_t l) {
+    if (buf->iov) {
+        if (l > 0) {
+            iov_copy(buf->iov, str, l);
+        }
+        return;
     }
 
-    unsigned int read = 0;
-    while ( (read = fread(input + read, 1, BUFSIZ, f)) > 0) {
-        size += read;
-        input = realloc(input, size + BUFSIZ);
-    }
+    buffer_append(buf, str, l);
+}
 
-    fclose(f);
+/* append text escaped for HTML. runs without characters to escape are appended in one go. */
+static void buffer_append_escaped(struct buffer *buf, const char *str, size_t l) {
+    /* escape directly into the output, reserving room for the worst case of a bounded chunk at a time */
+    if (!buf->sink && !buf->iov) {
+        while (l > 0) {
+            size_t n = l < ESCAPE_CHUNK_SIZE ? l : ESCAPE_CHUNK_SIZE;
+            buffer_reserve(buf, HTML_ESCAPE_MAX * n);
+            buf->size += html_escape(buf->string + buf->size, str, n);
+            str += n;
+            l -= n;
+        }
+        buf->string[buf->size] = '\0';
+        return;
+    }
 
-    input[size] = '\0';
-    return input;
-}
+    while (l > 0) {
+        size_t n = html_escape_span(str, l);
+        if (n > 0) {
+            buffer_append_dynamic(buf, str, n);
+        }
+        if (n == l) {
+            return;
+        }
 
-char *trim_trailing_whitespace(char *str) {
-    for (int i=strlen(str)-1; i >= 0 && isspace(str[i]); i--) {
-        str[i] = '\0';
+        size_t el;
+        const char *entity = html_entity(str[n], &el);
+        buffer_append_dynamic(buf, entity, el);
+        str += n + 1;
+        l -= n + 1;
     }
-    return str;
 }
 
-char *trim_leading_whitespace(char *str) {
-    while (isspace(*str)) {
-        str++;
+/* trim trailing whitespace from buffer */
+void buffer_rtrim(struct buffer *buf) {
+    if (buf->iov) {
+        struct iov_output *out = buf->iov;
+        while (out->iovcnt > 0) {
+            struct iovec *last = &out->iov[out->iovcnt - 1];
+            last->iov_len = rtrimmed_length(last->iov_base, last->iov_len);
+            if (last->iov_len > 0) {
+                break;
+            }
+            out->iovcnt--;
+        }
+        return;
     }
 
-    return str;
+    buf->size = rtrimmed_length(buf->string, buf->size);
+    buf->string[buf->size] = '\0';
 }
 
-struct unja_object *make_string_object(char *value, char *value2) {
-    struct unja_object *obj = malloc(sizeof *obj);
-    obj->type = OBJ_STRING;
-    int l = strlen(value) + 1;
-    if (value2) {
-        l += strlen(value2);
+
+/* join directory and file name, either of which may be NULL. returned string has to be freed. */
+static char *join_path(char *dir, char *name) {
+    size_t dir_len = dir ? strlen(dir) : 0;
+    size_t name_len = name ? strlen(name) : 0;
+    char *path = malloc(dir_len + name_len + 2);
+    if (!path) {
+        errx(EXIT_FAILURE, "out of memory");
     }
 
-   
-    obj->string = malloc(l);
-    obj->string_ptr = obj->string;
-    strcpy(obj->string, value);
-    
-    if(value2) {
-        strcat(obj->string, value2);
+    path[0] = '\0';
+    if (dir) {
+        strcpy(path, dir);
+    }
+    if (dir && name && dir_len > 0 && dir[dir_len - 1] != '/') {
+        strcat(path, "/");
     }
-    return obj;
+    if (name) {
+        strcat(path, name);
+    }
+    return path;
 }
 
-struct unja_object *make_int_object(int value) {
-    struct unja_object *obj = malloc(sizeof *obj);
-    obj->type = OBJ_INT;
-    obj->integer = value;
-    return obj;
+/* copy of a NUL-terminated string */
+static char *copy_string(const char *str) {
+    char *copy = malloc(strlen(str) + 1);
+    if (!copy) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    return strcpy(copy, str);
 }
 
+static const struct unja_filter builtin_filters[] = {
+    { "trim", filter_trim },
+    { "lower", filter_lower },
+    { "wordcount", filter_wordcount },
+    { "length", filter_length },
+    { "escape", filter_escape },
+    { "e", filter_escape },
+    { "safe", filter_safe },
+    { "truncate", filter_truncate },
+};
 
-void eval_object(struct buffer *buf, struct unja_object *obj) {
-    char tmp[64];
-
-    switch (obj->type) {
-        case OBJ_NULL: 
-            break;
-        case OBJ_STRING:
-            buffer_reserve(buf, strlen(obj->string));
-            strcat(buf->string, obj->string);
-            break;
-        case OBJ_INT: 
-            sprintf(tmp, "%d", obj->integer);
-            buffer_reserve(buf, strlen(tmp));
-            strcat(buf->string, tmp);
-            break;
+/* builtin filter or filter of env (which may be NULL) by name, or NULL if there is none */
+static const struct unja_filter *find_filter(struct env *env, const char *name) {
+    for (size_t i=0; i < sizeof builtin_filters / sizeof *builtin_filters; i++) {
+        if (strcmp(builtin_filters[i].name, name) == 0) {
+            return &builtin_filters[i];
+        }
+    }
+    for (int i=0; env != NULL && i < env->nfilters; i++) {
+        if (strcmp(env->filters[i].name, name) == 0) {
+            return &env->filters[i];
+        }
     }
+
+    return NULL;
 }
 
-int object_to_int(struct unja_object *obj) {
-     switch (obj->type) {
-        case OBJ_NULL: return 0; 
-        case OBJ_STRING: return atoi(obj->string);
-        case OBJ_INT: return obj->integer;
+/* look up the filters of a program once, so that rendering can call them by their number */
+static const struct unja_filter **resolve_filters(struct env *env, struct program *prog) {
+    int n = 0;
+    for (int pc=0; pc < prog->size; pc++) {
+        if (prog->code[pc].op == OP_FILTER && prog->code[pc].b >= n) {
+            n = prog->code[pc].b + 1;
+        }
+    }
+    if (n == 0) {
+        return NULL;
     }
 
-    return 0;
+    const struct unja_filter **filters = malloc(n * sizeof *filters);
+    if (!filters) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    for (int pc=0; pc < prog->size; pc++) {
+        struct instr *ins = &prog->code[pc];
+        if (ins->op == OP_FILTER) {
+            filters[ins->b] = find_filter(env, prog->strings + ins->a);
+        }
+    }
+    return filters;
 }
 
-void object_free(struct unja_object *obj) {
-    switch(obj->type) {
-        case OBJ_NULL: return;
-        case OBJ_STRING: 
-            free(obj->string_ptr);
-        break;
-        case OBJ_INT: break;
+/*
+ * link template with its ancestors into a single program. returns -1 and leaves it unlinked if one of them
+ * does not exist, the chain is too deep (which includes templates extending each other) or blocks nest too deeply.
+ */
+static int link_template(struct env *env, struct hashmap *templates, struct template *t) {
+    if (t->linked && t->linked != t->program) {
+        program_free(t->linked);
+    }
+    t->linked = NULL;
+    free(t->filters);
+    t->filters = NULL;
+    if (t->program->parent == NULL) {
+        t->linked = t->program;
+        t->filters = resolve_filters(env, t->linked);
+        return 0;
+    }
+
+    struct program *chain[MAX_INHERITANCE_DEPTH];
+    int n = 0;
+    struct template *p = t;
+    while (p != NULL && n < MAX_INHERITANCE_DEPTH) {
+        chain[n++] = p->program;
+
+        if (p->program->parent == NULL) {
+            t->linked = program_link(chain, n);
+            if (t->linked == NULL) {
+                return -1;
+            }
+            t->filters = resolve_filters(env, t->linked);
+            return 0;
+        }
+        p = hashmap_get(templates, p->program->parent);
     }
 
-    free(obj);
+    return -1;
 }
 
-int object_is_truthy(struct unja_object *obj) {
-    switch (obj->type) {
-        case OBJ_NULL: return 0; 
-        case OBJ_STRING: return strlen(obj->string) > 0 && strcmp(obj->string, "0") != 0;
-        case OBJ_INT: return obj->integer > 0;
+/* report why a template could not be linked */
+static void warn_unlinked(struct hashmap *templates, struct template *t) {
+    struct template *p = t;
+    for (int n=0; n < MAX_INHERITANCE_DEPTH; n++) {
+        char *parent_name = p->program->parent;
+        if (parent_name == NULL) {
+            warnx("blocks of template \"%s\" are nested too deeply", t->name);
+            return;
+        }
+        p = hashmap_get(templates, parent_name);
+        if (p == NULL) {
+            warnx("template \"%s\" extends unexisting parent \"%s\"", t->name, parent_name);
+            return;
+        }
     }
 
-    return 0;
+    warnx("inheritance chain of template \"%s\" is too deep", t->name);
 }
 
-struct context {
-    struct hashmap *vars;
-    struct hashmap *filters;
-    struct env *env;
-    struct template *current_template;
-};
+/* collect names of all templates in directory dirname/subdir, relative to dirname */
+static void scan_dir(char *dirname, char *subdir, int recursive, struct vector *names) {
+    char *dir = join_path(dirname, subdir);
+    DIR *dr = opendir(dir); 
+    if (dr == NULL) { 
+        errx(EXIT_FAILURE, "could not open directory \"%s\"", dir); 
+    } 
 
-struct unja_object *eval_expression_value(mpc_ast_t* node, struct context *ctx) {
-    if (strstr(node->tag, "symbol|")) {
-        /* Return empty string if no vars were passed. Should probably signal error here. */
-        if (ctx->vars == NULL) {
-           return &null_object;
+    struct dirent *de;   
+    while ((de = readdir(dr)) != NULL) {
+        // skip files starting with a dot
+        if (de->d_name[0] == '.') {
+            continue;
         }
 
-        char *key = node->contents;
-        char *value = hashmap_resolve(ctx->vars, key);
+        // copy template name as closedir free's it otherwise
+        char *name = join_path(subdir, de->d_name);
+        char *path = join_path(dirname, name);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            errx(EXIT_FAILURE, "could not stat \"%s\"", path);
+        }
+        free(path);
 
-        /* TODO: Handle unexisting symbols (returns NULL currently) */
-        if (value == NULL) {
-            return &null_object;
+        if (S_ISDIR(st.st_mode)) {
+            if (recursive) {
+                scan_dir(dirname, name, recursive, names);
+            }
+            free(name);
+            continue;
         }
 
-        return make_string_object(value, NULL);
-    } else if(strstr(node->tag, "number|")) {
-        return make_int_object(atoi(node->contents));
-    } else if(strstr(node->tag, "string|")) {
-        return make_string_object(node->children[1]->contents, NULL);
+        vector_push(names, name);
     }
-
-    return &null_object;
+  
+    closedir(dr); 
+    free(dir);
 }
 
-struct unja_object *eval_string_infix_expression(struct unja_object *left, char *op, struct unja_object *right) {
-    struct unja_object *result;
-
-    if (strcmp(op, "+") == 0) {
-        result = make_string_object(left->string, right->string);
-    } else if (strcmp(op, "==") == 0) {
-        result = make_int_object(strcmp(left->string, right->string) == 0);
-    } else if(strcmp(op, "!=") == 0) {
-        result = make_int_object(strcmp(left->string, right->string) != 0);
-    } else {
-        errx(EXIT_FAILURE, "invalid string operator: %s", op);
+/* read and compile a template file, relative to dirname instead of changing the working directory of the whole process */
+static struct program *compile_file(char *dirname, char *name, struct parse_error *error) {
+    char *path = join_path(dirname, name);
+    char *tmpl = read_file(path);
+    free(path);
+    #if DEBUG
+    printf("Parsing template from file %s: %s\n", name, tmpl);
+    #endif
+    struct ast *ast = parse(tmpl, error);
+    if (ast == NULL) {
+        free(tmpl);
+        return NULL;
     }
 
-    object_free(left);
-    object_free(right);
-    return result;
+    struct program *prog = compile(ast);
+    ast_free(ast);
+    free(tmpl);
+    return prog;
 }
 
-struct unja_object *eval_infix_expression(struct unja_object *left, char *op, struct unja_object *right) {
-    /* if operator is + and either left or right node is of type string: concat */
-    if (left->type == OBJ_STRING && right->type == OBJ_STRING) {           
-        return eval_string_infix_expression(left, op, right);
-    } 
-
-    int result;
-    switch (op[0]) {
-        case '+': result = object_to_int(left) + object_to_int(right); break;
-        case '-': result = object_to_int(left) - object_to_int(right); break;
-        case '/': result = object_to_int(left) / object_to_int(right); break;
-        case '*': result = object_to_int(left) * object_to_int(right); break;
-        case '%': result = object_to_int(left) % object_to_int(right); break;
-        case '>': 
-            if (op[1] == '=') {
-                result = object_to_int(left) >= object_to_int(right);    
-            } else {
-                result = object_to_int(left) > object_to_int(right); 
-            }
-            break;
-        case '<': 
-            if (op[1] == '=') {
-                result = object_to_int(left) <= object_to_int(right);    
-            } else {
-                result = object_to_int(left) < object_to_int(right); 
-            }
-            break;
-        case '!': 
-            if (op[1] == '=') {
-                result = object_to_int(left) != object_to_int(right);    
-            } else {
-                errx(EXIT_FAILURE, "invalid int operator: %s", op);
-            }
-            break;
-        case '=': 
-            if (op[1] == '=') {
-                result = object_to_int(left) == object_to_int(right);    
-            } else {
-                errx(EXIT_FAILURE, "invalid int operator: %s", op);
-            }
-            break;
+/*
+ * compile a template, or take it from the env's cache file if it is up to date.
+ * returns 1 if it had to be compiled, or reports why and returns -1 if it could not be.
+ */
+static int load_template(struct env *env, struct template *t) {
+    char *path = join_path(env->dirname, t->name);
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        warnx("could not stat \"%s\"", path);
+        free(path);
+        return -1;
+    }
+    free(path);
+    t->mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    t->source_size = st.st_size;
+
+    if (env->cache) {
+        t->program = cache_get(env->cache, t->name, t->mtime_ns, t->source_size);
+        if (t->program) {
+            return 0;
+        }
     }
 
-    object_free(left);
-    object_free(right);
-    return make_int_object(result);
+    struct parse_error error;
+    t->program = compile_file(env->dirname, t->name, &error);
+    if (t->program == NULL) {
+        warnx("%s:%d:%d: %s", t->name, error.line, error.col, error.message);
+        return -1;
+    }
+    return 1;
 }
 
-struct unja_object *eval_expression(mpc_ast_t* expr, struct context *ctx) {
-
-    /* singular term */
-    if (expr->children_num == 0 || strstr(expr->tag, "string|")) {
-        return eval_expression_value(expr, ctx);
+static struct template *template_new(char *name) {
+    struct template *t = malloc(sizeof *t);
+    if (!t) {
+        errx(EXIT_FAILURE, "out of memory");
     }
+    t->name = name;
+    t->program = NULL;
+    t->linked = NULL;
+    t->filters = NULL;
+    t->mtime_ns = 0;
+    t->source_size = 0;
+    t->refs = 0;
+    t->size = 0;
+    t->lru_prev = NULL;
+    t->lru_next = NULL;
+    return t;
+}
 
-    struct unja_object *result;
+/* templates to load, shared by all workers */
+struct loader {
+    struct env *env;
+    struct template **templates;
+    int size;
 
-    /* singular negated term */
-    if (strcmp(expr->children[0]->contents, "not") == 0) {
-        result = eval_expression_value(expr->children[2], ctx);
-        struct unja_object *negated = make_int_object(!object_to_int(result));
-        object_free(result);
-        return negated;
-    }
+    /* index of the next template that is not picked up by a worker yet */
+    int next;
 
-    /* otherwise: with operator */
-    unsigned int offset = 0; 
-    mpc_ast_t *left_node = expr->children[0];
-    struct unja_object *left = eval_expression(left_node, ctx);
-    result = left;
+    /* number of templates that were not found in the cache */
+    int compiled;
+};
 
-    while (offset < (expr->children_num - 1)) {
-        /* Check if we arrived at a filter (guaranteed to be last in expression list) */
-        if (strstr(expr->children[offset+1]->tag, "filter")) {
-            char *filter_name = expr->children[offset+1]->children[3]->contents;
-            struct unja_object *(*filter_fn)(struct unja_object *) = hashmap_get(ctx->filters, filter_name);
-            if (NULL == filter_fn) {
-                errx(EXIT_FAILURE, "unknown filter: %s", filter_name);
-            }
-            result = filter_fn(result);
-            break;
+static void *load_worker(void *arg) {
+    struct loader *l = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED)) < l->size) {
+        int compiled = load_template(l->env, l->templates[i]);
+        if (compiled < 0) {
+            exit(EXIT_FAILURE);
         }
+        if (compiled) {
+            __atomic_add_fetch(&l->compiled, 1, __ATOMIC_RELAXED);
+        }
+    }
 
+    return NULL;
+}
 
-        mpc_ast_t *op = expr->children[offset+2];
-        mpc_ast_t *right_node = expr->children[offset+4];
-        struct unja_object *right = eval_expression(right_node, ctx);
-        result = eval_infix_expression(left, op->contents, right);
-
-        left = result;
-        offset += 4;
+static void write_cache(char *path, struct template **templates, int n) {
+    struct cache_item *items = malloc(n * sizeof *items);
+    if (!items && n > 0) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    for (int i=0; i < n; i++) {
+        items[i].name = templates[i]->name;
+        items[i].mtime_ns = templates[i]->mtime_ns;
+        items[i].size = templates[i]->source_size;
+        items[i].program = templates[i]->program;
     }
 
-    return result;
-   
+    if (cache_write(path, items, n) != 0) {
+        warnx("could not write template cache \"%s\"", path);
+    }
+    free(items);
 }
 
-int eval(struct buffer *buf, mpc_ast_t* t, struct context *ctx) {
-    static int trim_whitespace = 0;
+struct env *env_new_with_options(char *dirname, struct env_options *options) {
+    struct vector *names = vector_new(16);
+    scan_dir(dirname, NULL, options->recursive, names);
 
-    // maybe eat whitespace going backward
-    if (t->children_num > 0 && strstr(t->children[0]->contents, "-")) {
-        buf->string = trim_trailing_whitespace(buf->string);
+    struct env *env = malloc(sizeof *env);
+    struct template **templates = malloc(names->size * sizeof *templates);
+    if (!env || (!templates && names->size > 0)) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    env->templates = hashmap_new_with_cap(names->size);
+    env->dirname = join_path(dirname, NULL);
+    env->recursive = options->recursive;
+    env->autoescape = options->autoescape;
+    env->filters = NULL;
+    env->nfilters = options->nfilters;
+    if (options->nfilters > 0) {
+        env->filters = malloc(options->nfilters * sizeof *env->filters);
+        if (!env->filters) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+    }
+    for (int i=0; i < options->nfilters; i++) {
+        if (find_filter(NULL, options->filters[i].name) != NULL) {
+            errx(EXIT_FAILURE, "filter \"%s\" is a builtin filter", options->filters[i].name);
+        }
+        env->filters[i].name = copy_string(options->filters[i].name);
+        env->filters[i].fn = options->filters[i].fn;
+    }
+    env->epoch = 0;
+    env->readers[0] = 0;
+    env->readers[1] = 0;
+    env->watcher = NULL;
+    pthread_mutex_init(&env->reload_lock, NULL);
+    env->cache = options->cache_file ? cache_open(options->cache_file) : NULL;
+    env->lazy = options->lazy;
+    env->cache_size = options->cache_size;
+    env->cache_used = 0;
+    env->lru_head = NULL;
+    env->lru_tail = NULL;
+    pthread_mutex_init(&env->lock, NULL);
+
+    for (int i=0; i < names->size; i++) {
+        templates[i] = template_new(names->values[i]);
     }
 
-    if (strstr(t->tag, "content|text")) {
-        char *str = t->contents;
-        if (trim_whitespace) {
-            str = trim_leading_whitespace(str);
-            trim_whitespace = 0;
+    /* in lazy mode only the names are indexed, templates are compiled when they are first rendered */
+    if (env->lazy) {
+        for (int i=0; i < names->size; i++) {
+            hashmap_insert(env->templates, templates[i]->name, templates[i]);
         }
+        free(templates);
+        vector_free(names);
+        return env;
+    }
 
-        buffer_reserve(buf, strlen(str));
-        strcat(buf->string, str);
-        return 0;
+    /* reading and compiling templates is independent, so spread it over workers */
+    struct loader loader = { env, templates, names->size, 0, 0 };
+    int nthreads = options->threads > 0 ? options->threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > MAX_LOAD_THREADS) {
+        nthreads = MAX_LOAD_THREADS;
+    }
+    if (nthreads > names->size) {
+        nthreads = names->size;
     }
 
-    if (strstr(t->tag, "content|statement|block")) {
-        trim_whitespace = strstr(t->children[3]->contents, "-") ? 1 : 0;
-        char *block_name = t->children[2]->contents;
-        
-        // find block in "lowest" template
-        struct template *templ = ctx->current_template;
-        mpc_ast_t *block = hashmap_get(templ->blocks, block_name);
-        while (templ != NULL && block == NULL) {
-            templ = hashmap_get(ctx->env->templates, templ->parent);
-            block = hashmap_get(templ->blocks, block_name);
-        }
-        
-        if (block) {
-            eval(buf, block->children[4], ctx);
-        } else {
-            /* block not found in any lower template, so just render the one we got */
-            eval(buf, t->children[4], ctx);
-        }
+    pthread_t threads[MAX_LOAD_THREADS];
+    int started = 0;
+    while (started < nthreads - 1 && pthread_create(&threads[started], NULL, load_worker, &loader) == 0) {
+        started++;
+    }
+    load_worker(&loader);
+    for (int i=0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
 
-        trim_whitespace = strstr(t->children[7]->contents, "-") ? 1 : 0;
-        return 0;
+    for (int i=0; i < names->size; i++) {
+        hashmap_insert(env->templates, templates[i]->name, templates[i]);
     }
 
-    // eval print statement
-    if (strstr(t->tag, "content|print")) {
-        trim_whitespace = strstr(t->children[2]->contents, "-") ? 1 : 0;
-        mpc_ast_t *expr = t->children[1];      
-        struct unja_object *obj = eval_expression(expr, ctx);  
-        eval_object(buf, obj);
-        object_free(obj);
-        return 0;
+    /* all templates are known now, so inheritance can be resolved */
+    for (int i=0; i < names->size; i++) {
+        link_template(env, env->templates, templates[i]);
     }
 
-    if (strstr(t->tag, "content|statement|for")) {
-        char *tmp_key = t->children[2]->contents;
-        char *iterator_key = t->children[4]->contents;
-        struct vector *list = hashmap_resolve(ctx->vars, iterator_key);
+    if (options->cache_file && (env->cache == NULL || loader.compiled > 0)) {
+        write_cache(options->cache_file, templates, names->size);
+    }
 
-        /* add "loop" variable to context */
-        struct hashmap *loop = hashmap_new();
-        char index[8], first[2], last[2];
-        hashmap_insert(loop, "index", index);
-        hashmap_insert(loop, "first", first);
-        hashmap_insert(loop, "last", last);
-        hashmap_insert(ctx->vars, "loop", loop);
+    free(templates);
+    vector_free(names);
+    return env;
+}
 
-        /* loop over values in vector */
-        for (int i=0; i < list->size; i++) {
-            /* set loop variable values */
-            sprintf(index, "%d", i);
-            sprintf(first, "%d", i == 0);
-            sprintf(last, "%d", i == (list->size - 1));
-            hashmap_insert(ctx->vars, tmp_key, list->values[i]);
-            trim_whitespace = strstr(t->children[5]->contents, "-") ? 1 : 0;
+struct env *env_new(char *dirname) {
+    struct env_options options = {
+        .threads = 0,
+        .recursive = 1,
+    };
+    return env_new_with_options(dirname, &options);
+}
 
-            /* evaluate body */
-            eval(buf, t->children[6], ctx);
+void env_each_template(struct env *env, void (*fn)(char *name, struct program *prog, void *data), void *data) {
+    struct hashmap *templates = env->templates;
+    for (size_t i=0; i < templates->cap; i++) {
+        if (templates->entries[i].key == NULL) {
+            continue;
         }
 
-        /* remove "loop" variable from context */
-        hashmap_remove(ctx->vars, "loop");
-        hashmap_free(loop);
-
-        /* trim trailing whitespace if closing tag has minus sign */
-        if (strstr(t->children[7]->contents, "-")) {
-            buf->string = trim_trailing_whitespace(buf->string);
+        struct template *t = templates->entries[i].value;
+        if (t->linked == NULL) {
+            warn_unlinked(templates, t);
+            exit(EXIT_FAILURE);
         }
-        
-        trim_whitespace = strstr(t->children[9]->contents, "-") ? 1 : 0;
-        return 0;
+        fn(t->name, t->linked, data);
     }
+}
 
-    if (strstr(t->tag, "content|statement|if")) {
-        mpc_ast_t *expr = t->children[2];
-        struct unja_object *result = eval_expression(expr, ctx);
+/* free the programs of a template, but not the template itself */
+static void template_unload(struct template *t) {
+    if (t->linked && t->linked != t->program) {
+        program_free(t->linked);
+    }
+    if (t->program) {
+        program_free(t->program);
+    }
+    free(t->filters);
+    t->linked = NULL;
+    t->program = NULL;
+    t->filters = NULL;
+}
 
-        if (object_is_truthy(result)) {
-            trim_whitespace = strstr(t->children[3]->contents, "-") ? 1 : 0;
+void template_free(void *v) {
+    struct template *t = (struct template *)v;
+    template_unload(t);
+    free(t->name);
+    free(t);
+}
 
-            eval(buf, t->children[4], ctx);
+void env_free(struct env *env) {
+    if (env->watcher) {
+        watcher_free(env->watcher);
+    }
+    hashmap_walk(env->templates, template_free);
+    hashmap_free(env->templates);
+    if (env->cache) {
+        cache_close(env->cache);
+    }
+    pthread_mutex_destroy(&env->reload_lock);
+    pthread_mutex_destroy(&env->lock);
+    for (int i=0; i < env->nfilters; i++) {
+        free((char *) env->filters[i].name);
+    }
+    free(env->filters);
+    free(env->dirname);
+    free(env);
+}
 
-            /* trim trailing whitespace if closing tag has minus sign */
-            if (strstr(t->children[5]->contents, "-")) {
-                buf->string = trim_trailing_whitespace(buf->string);
-            }
+static void lru_unlink(struct env *env, struct template *t) {
+    if (t->lru_prev) {
+        t->lru_prev->lru_next = t->lru_next;
+    } else if (env->lru_head == t) {
+        env->lru_head = t->lru_next;
+    }
+    if (t->lru_next) {
+        t->lru_next->lru_prev = t->lru_prev;
+    } else if (env->lru_tail == t) {
+        env->lru_tail = t->lru_prev;
+    }
+    t->lru_prev = NULL;
+    t->lru_next = NULL;
+}
 
-            trim_whitespace = strstr(t->children[7]->contents, "-") ? 1 : 0;
-        } else {
-            if (t->children_num > 8) {
-                trim_whitespace = strstr(t->children[7]->contents, "-") ? 1 : 0;
-                eval(buf, t->children[8], ctx);
+/* move template to the front of the cache, updating the bytes it uses */
+static void lru_touch(struct env *env, struct template *t) {
+    lru_unlink(env, t);
+    env->cache_used -= t->size;
+    t->size = program_size(t->program);
+    if (t->linked && t->linked != t->program) {
+        t->size += program_size(t->linked);
+    }
+    env->cache_used += t->size;
 
-                 /* trim trailing whitespace if closing tag has minus sign */
-                if (strstr(t->children[9]->contents, "-")) {
-                    buf->string = trim_trailing_whitespace(buf->string);
-                }
+    t->lru_next = env->lru_head;
+    if (env->lru_head) {
+        env->lru_head->lru_prev = t;
+    } else {
+        env->lru_tail = t;
+    }
+    env->lru_head = t;
+}
 
-                trim_whitespace = strstr(t->children[11]->contents, "-") ? 1 : 0;
-            }
+/* unload least recently used templates that are not being rendered until the cache fits its size */
+static void lru_evict(struct env *env) {
+    struct template *t = env->lru_tail;
+    while (t != NULL && env->cache_size > 0 && env->cache_used > env->cache_size) {
+        struct template *prev = t->lru_prev;
+        if (t->refs == 0) {
+            lru_unlink(env, t);
+            env->cache_used -= t->size;
+            t->size = 0;
+            template_unload(t);
         }
-
-        object_free(result);
-        return 0;
+        t = prev;
     }
+}
+
+/*
+ * compile a template and its ancestors as far as needed and link them. called with the env locked.
+ * the template is left unlinked if it can not be linked, or if one of them fails to compile, which is reported and returns -1.
+ */
+static int load_lazily(struct env *env, struct template *t) {
+    struct template *p = t;
+    for (int n=0; p != NULL && n < MAX_INHERITANCE_DEPTH; n++) {
+        if (p->program == NULL) {
+            if (load_template(env, p) < 0) {
+                return -1;
+            }
+            lru_touch(env, p);
+        }
 
-    for (int i=0; i < t->children_num; i++) {
-        eval(buf, t->children[i], ctx);
+        char *parent_name = p->program->parent;
+        if (parent_name == NULL) {
+            break;
+        }
+        p = hashmap_get(env->templates, parent_name);
     }
 
+    link_template(env, env->templates, t);
+    lru_touch(env, t);
     return 0;
 }
 
-char *render_ast(mpc_ast_t *ast, struct context *ctx) {
-    #if DEBUG
-    printf("AST: \n");
-    mpc_ast_print(ast);
-    printf("\n");
-    #endif
-
-    struct buffer buf;
-    buf.size = 0;
-    buf.cap = 256;
-    buf.string = malloc(buf.cap);
-    buf.string[0] = '\0';
-    eval(&buf, ast, ctx);
-    return buf.string;
+/* start a render, returns the slot to pass to env_leave() once it is done with the templates */
+static int env_enter(struct env *env) {
+    int slot = __atomic_load_n(&env->epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_add_fetch(&env->readers[slot], 1, __ATOMIC_SEQ_CST);
+    return slot;
 }
 
-struct unja_object *filter_trim(struct unja_object *obj) {
-    assert(obj->type == OBJ_STRING);
-    obj->string = trim_leading_whitespace(obj->string);
-    trim_trailing_whitespace(obj->string);
-    return obj;
+static void env_leave(struct env *env, int slot) {
+    __atomic_sub_fetch(&env->readers[slot], 1, __ATOMIC_SEQ_CST);
 }
 
-struct unja_object *filter_lower(struct unja_object *obj) {
-    assert(obj->type == OBJ_STRING);
-    int len = strlen(obj->string);
-    for (int i=0; i < len; i++) {
-        obj->string[i] = tolower(obj->string[i]);
+/* 
+ * wait until all renders that might still use the previously published templates are done.
+ * new renders enter the other slot in the meantime, so they are never blocked.
+ * a render that read the epoch just before it changed enters the old slot late, hence the slots are drained twice.
+ */
+static void env_synchronize(struct env *env) {
+    for (int i=0; i < 2; i++) {
+        int slot = __atomic_fetch_add(&env->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+        while (__atomic_load_n(&env->readers[slot], __ATOMIC_SEQ_CST) > 0) {
+            sched_yield();
+        }
     }
-    return obj;
 }
 
-struct unja_object *filter_wordcount(struct unja_object *obj) {
-    assert(obj->type == OBJ_STRING);
-    int len = strlen(obj->string);
-    int word_count = 1;
-    for (int i=0; i < len; i++) {
-        if (isspace(obj->string[i])) {
-            word_count++;
+static int contains(char **names, int n, char *name) {
+    for (int i=0; i < n; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return 1;
         }
     }
 
-    object_free(obj);
-    return make_int_object(word_count);
+    return 0;
 }
 
+/* names, with the name of a directory (ending in a slash, or empty for the env's directory) replaced by all templates below it */
+static struct vector *expand_names(struct hashmap *templates, char **names, int n) {
+    struct vector *expanded = vector_new(n);
+    struct hashmap *seen = hashmap_new_with_cap(n);
+    for (int i=0; i < n; i++) {
+        size_t length = strlen(names[i]);
+        if (length > 0 && names[i][length - 1] != '/') {
+            if (hashmap_insert(seen, names[i], names[i]) == NULL) {
+                vector_push(expanded, names[i]);
+            }
+            continue;
+        }
 
-struct unja_object *filter_length(struct unja_object *obj) {
-    assert(obj->type == OBJ_STRING);
-    int len = strlen(obj->string);
-    object_free(obj);
-    return make_int_object(len);
-}
-
-struct hashmap *default_filters() {
-    struct hashmap *filters = hashmap_new();
-    hashmap_insert(filters, "trim", filter_trim);
-    hashmap_insert(filters, "lower", filter_lower);
-    hashmap_insert(filters, "wordcount", filter_wordcount);
-    hashmap_insert(filters, "length", filter_length);
-    return filters;
-}
+        for (size_t j=0; j < templates->cap; j++) {
+            struct template *t = templates->entries[j].value;
+            if (t != NULL && strncmp(t->name, names[i], length) == 0 && hashmap_insert(seen, t->name, t->name) == NULL) {
+                vector_push(expanded, t->name);
+            }
+        }
+    }
 
-struct context context_new(struct hashmap *vars, struct env *env, struct template *current_tmpl) {
-    struct context ctx;
-    ctx.filters = default_filters();
-    ctx.vars = vars;
-    ctx.env = env;
-    ctx.current_template = current_tmpl;    
-    return ctx;
+    hashmap_free(seen);
+    return expanded;
+}
+
+/* whether t or one of its ancestors is named in names */
+static int extends_any(struct hashmap *templates, struct template *t, char **names, int n) {
+    for (int depth = 0; t != NULL && depth < MAX_INHERITANCE_DEPTH; depth++) {
+        if (contains(names, n, t->name)) {
+            return 1;
+        }
+        if (t->program == NULL || t->program->parent == NULL) {
+            return 0;
+        }
+        if (contains(names, n, t->program->parent)) {
+            return 1;
+        }
+        t = hashmap_get(templates, t->program->parent);
+    }
+
+    return 0;
+}
+
+/*
+ * Recompile the named templates (relative to the env's directory) and all templates extending them.
+ * Templates that no longer exist are removed, new ones are added. A name ending in a slash stands for all templates
+ * below that directory, an empty name for all templates. If a template fails to compile, or can not be linked
+ * because a parent is gone or its chain extends itself, its previous version is kept.
+ * Renders are not blocked: those in progress finish with the old templates, which are freed once they are done.
+ * Returns the number of templates that were replaced.
+ */
+int env_reload(struct env *env, char **names, int n) {
+    if (env->lazy) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&env->reload_lock);
+    struct hashmap *old = env->templates;
+    struct vector *expanded = expand_names(old, names, n);
+    names = (char **) expanded->values;
+    n = expanded->size;
+
+    struct hashmap *templates = hashmap_new_with_cap(old->size + n);
+    struct vector *created = vector_new(n);
+    struct vector *replaced = vector_new(n);
+
+    /* compile changed templates that (still) exist */
+    for (int i=0; i < n; i++) {
+        struct template *prev = hashmap_get(old, names[i]);
+        char *path = join_path(env->dirname, names[i]);
+        struct stat st;
+        int exists = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+        free(path);
+
+        if (!exists) {
+            if (prev) {
+                vector_push(replaced, prev);
+            }
+            continue;
+        }
+
+        struct parse_error error;
+        struct program *prog = compile_file(env->dirname, names[i], &error);
+        if (prog == NULL) {
+            warnx("%s:%d:%d: %s", names[i], error.line, error.col, error.message);
+            if (prev) {
+                hashmap_insert(templates, prev->name, prev);
+            }
+            continue;
+        }
+
+        struct template *t = template_new(copy_string(names[i]));
+        t->program = prog;
+        vector_push(created, t);
+        if (prev) {
+            vector_push(replaced, prev);
+        }
+    }
+
+    /* unchanged templates are shared with the previous version */
+    for (size_t i=0; i < old->cap; i++) {
+        struct template *t = old->entries[i].value;
+        if (t != NULL && !contains(names, n, t->name)) {
+            hashmap_insert(templates, t->name, t);
+        }
+    }
+    for (int i=0; i < created->size; i++) {
+        struct template *t = created->values[i];
+        hashmap_insert(templates, t->name, t);
+    }
+
+    /* templates extending a changed template have to be linked again, so they are compiled into a new version as well */
+    for (size_t i=0; i < templates->cap; i++) {
+        struct template *t = templates->entries[i].value;
+        if (t == NULL || contains(names, n, t->name) || !extends_any(templates, t, names, n)) {
+            continue;
+        }
+
+        struct parse_error error;
+        struct program *prog = compile_file(env->dirname, t->name, &error);
+        if (prog == NULL) {
+            warnx("%s:%d:%d: %s", t->name, error.line, error.col, error.message);
+            continue;
+        }
+
+        struct template *copy = template_new(copy_string(t->name));
+        copy->program = prog;
+        vector_push(created, copy);
+        vector_push(replaced, t);
+        hashmap_insert(templates, copy->name, copy);
+    }
+
+    /*
+     * a changed template that can not be linked anymore, because a parent is gone or the chain now extends itself, keeps its
+     * previous version. that changes what the templates extending it link to, so linking is repeated until none is put back.
+     */
+    int kept;
+    do {
+        kept = 0;
+        for (int i=0; i < created->size; i++) {
+            struct template *t = created->values[i];
+            struct template *prev = hashmap_get(old, t->name);
+            if (link_template(env, templates, t) == 0 || prev == NULL || prev->linked == NULL) {
+                continue;
+            }
+
+            warn_unlinked(templates, t);
+            hashmap_insert(templates, prev->name, prev);
+            for (int j=0; j < replaced->size; j++) {
+                if (replaced->values[j] == prev) {
+                    replaced->values[j] = replaced->values[--replaced->size];
+                    break;
+                }
+            }
+            created->values[i--] = created->values[--created->size];
+            template_free(t);
+            kept = 1;
+        }
+    } while (kept);
+
+    /* publish the new templates, then free the old ones once no render uses them anymore */
+    __atomic_store_n(&env->templates, templates, __ATOMIC_SEQ_CST);
+    env_synchronize(env);
+    hashmap_free(old);
+    for (int i=0; i < replaced->size; i++) {
+        template_free(replaced->values[i]);
+    }
+
+    int count = created->size;
+    vector_free(created);
+    vector_free(replaced);
+    vector_free(expanded);
+    pthread_mutex_unlock(&env->reload_lock);
+    return count;
+}
+
+static void on_change(char **names, int n, void *env) {
+    env_reload(env, names, n);
+}
+
+/* reload changed templates in the background, returns 0 on success or -1 if the env can not be watched */
+int env_watch(struct env *env) {
+    if (env->lazy || env->watcher) {
+        return -1;
+    }
+
+    env->watcher = watcher_new(env->dirname, env->recursive, on_change, env);
+    return env->watcher ? 0 : -1;
+}
+
+static void program_stats(struct env_stats *stats, struct program *prog) {
+    size_t blocks = program_blocks_size(prog);
+    size_t size = program_size(prog) - blocks;
+    stats->block_bytes += blocks;
+    if (prog->mapped) {
+        stats->program_bytes += sizeof *prog;
+        stats->mapped_bytes += size - sizeof *prog;
+    } else {
+        stats->program_bytes += size;
+    }
+}
+
+/* report the memory held by env. for a lazy env this changes as templates are compiled and evicted. */
+void env_stats(struct env *env, struct env_stats *stats) {
+    memset(stats, 0, sizeof *stats);
+    int slot = env_enter(env);
+    struct hashmap *templates = __atomic_load_n(&env->templates, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&env->lock);
+    stats->index_bytes = sizeof *templates + templates->cap * sizeof *templates->entries;
+    for (size_t i=0; i < templates->cap; i++) {
+        if (templates->entries[i].key == NULL) {
+            continue;
+        }
+
+        struct template *t = templates->entries[i].value;
+        stats->templates++;
+        stats->name_bytes += strlen(t->name) + 1;
+        stats->index_bytes += sizeof *t;
+        if (t->program) {
+            stats->compiled++;
+            program_stats(stats, t->program);
+        }
+        if (t->linked && t->linked != t->program) {
+            program_stats(stats, t->linked);
+        }
+    }
+    pthread_mutex_unlock(&env->lock);
+    env_leave(env, slot);
+}
+
+/* read a whole file into a NUL-terminated string, sized by fstat() so that it is read in one go */
+char *read_file(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        errx(EXIT_FAILURE, "could not open \"%s\" for reading", filename);
+    }
+
+    size_t size = st.st_size;
+    char *input = malloc(size + 1);
+    if (!input) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+
+    /* a file may be shorter than it was when it was stat'ed, if it is being written */
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = read(fd, input + total, size - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            errx(EXIT_FAILURE, "could not read \"%s\"", filename);
+        }
+        if (n == 0) {
+            break;
+        }
+        total += n;
+    }
+
+    close(fd);
+    input[total] = '\0';
+    return input;
+}
+
+char *trim_trailing_whitespace(char *str) {
+    str[rtrimmed_length(str, strlen(str))] = '\0';
+    return str;
+}
+
+char *trim_leading_whitespace(char *str) {
+    while (isspace(*str)) {
+        str++;
+    }
+
+    return str;
+}
+
+void eval_object(struct buffer *buf, struct unja_object *obj, int autoescape) {
+    char tmp[64];
+
+    switch (obj->type) {
+        case OBJ_NULL: 
+        case OBJ_LIST:
+        case OBJ_MAP:
+            break;
+        case OBJ_STRING:
+            if (autoescape && !obj->safe) {
+                buffer_append_escaped(buf, object_string(obj), obj->length);
+            } else {
+                buffer_append_dynamic(buf, object_string(obj), obj->length);
+            }
+            break;
+        case OBJ_INT: 
+            buffer_append_dynamic(buf, tmp, sprintf(tmp, "%d", obj->integer));
+            break;
+        case OBJ_FLOAT:
+            buffer_append_dynamic(buf, tmp, format_float(tmp, obj->number));
+            break;
+    }
+}
+
+/* state of a running for loop */
+struct loop {
+    /* items are taken from list or iter, or are the numbers up to size for range() */
+    struct vector *list;
+    struct unja_value *iter;
+    int size;
+    int i;
+
+    /* name of the loop variable and its hash, for lookups by name from blocks */
+    char *key;
+    size_t key_length;
+    unsigned int key_hash;
+
+    /* current item of a range or iterator, and the item an iterator produced after it */
+    struct unja_value number;
+    void *item;
+    void *next;
+    int item_typed;
+
+    /* fields of loop, for lookups by name from blocks */
+    struct unja_value index;
+    struct unja_value first;
+    struct unja_value last;
+};
+
+/* state of a single render. the environment and programs are never modified while rendering. */
+struct context {
+    /* variables passed by the caller, read-only. loop variables live in the loop state instead. */
+    struct hashmap *vars;
+
+    /* filter of every OP_FILTER by its number, resolved when the program was linked */
+    const struct unja_filter **filters;
+
+    /* whether strings that are not marked safe are escaped for HTML when they are output */
+    int autoescape;
+
+    /* all objects created during a render are allocated from here */
+    struct arena *arena;
+
+    /* counters of the render, or NULL if it does not collect stats */
+    struct render_stats *stats;
+
+    /* time spent per instruction, or NULL if the render is not profiled */
+    struct profile_sample *profile;
+
+    /* whether leading whitespace of the next text should be trimmed */
+    int trim_next;
+
+    struct unja_object *stack;
+    int stack_size;
+    int stack_cap;
+
+    /* loop state by nesting depth, reused by loops at the same depth */
+    struct loop **loops;
+    int loops_size;
+    int loops_cap;
+};
+
+/* grow an array allocated from the arena to twice its capacity */
+static void *arena_grow(struct arena *arena, void *array, int *cap, size_t size) {
+    void *grown = arena_alloc(arena, *cap * 2 * size);
+    memcpy(grown, array, *cap * size);
+    memset((char *) grown + *cap * size, 0, *cap * size);
+    *cap *= 2;
+    return grown;
+}
+
+static struct unja_object *push(struct context *ctx) {
+    if (ctx->stack_size == ctx->stack_cap) {
+        ctx->stack = arena_grow(ctx->arena, ctx->stack, &ctx->stack_cap, sizeof *ctx->stack);
+    }
+
+    return &ctx->stack[ctx->stack_size++];
+}
+
+/* look up segment s in hm, setting typed to whether the variable found is a struct unja_value */
+static void *get_segment(struct context *ctx, struct hashmap *hm, struct program *prog, struct segment *s, int *typed) {
+    struct hashmap_entry *e = hashmap_get_entry(hm, prog->strings + s->name, s->length, s->hash, ctx->stats ? &ctx->stats->hashmap_probes : NULL);
+    *typed = e->typed;
+    return e->value;
+}
+
+/* map of a variable a path continues into, or NULL if it is not a map */
+static struct hashmap *var_map(void *var, int typed) {
+    if (typed) {
+        struct unja_value *value = var;
+        return value->type == UNJA_MAP ? value->map : NULL;
+    }
+
+    return var;
+}
+
+/* follow the rest of the path starting at segment s from var, the variable named by s. typed is
+   whether var is a struct unja_value and is set to whether the variable the path ends at is one. */
+static void *resolve_path(struct context *ctx, struct program *prog, void *var, struct segment *s, int *typed) {
+    struct hashmap *hm = var;
+    while (hm != NULL && !s->last && (hm = var_map(hm, *typed)) != NULL) {
+        s++;
+        hm = get_segment(ctx, hm, prog, s, typed);
+    }
+
+    return hm;
+}
+
+/* field of loop named by segment s, or NULL if there is no such field */
+static struct unja_value *loop_var(struct loop *loop, struct program *prog, struct segment *s) {
+    const char *name = prog->strings + s->name;
+    if (s->length == 5 && memcmp(name, "index", 5) == 0) {
+        return &loop->index;
+    }
+    if (s->length == 5 && memcmp(name, "first", 5) == 0) {
+        return &loop->first;
+    }
+    if (s->length == 4 && memcmp(name, "last", 4) == 0) {
+        return &loop->last;
+    }
+
+    return NULL;
+}
+
+/* look up the variable named by the path starting at segment s. loop variables are
+   usually resolved at compile time, only names in blocks are looked up on the loop stack. */
+static void *resolve(struct context *ctx, struct program *prog, struct segment *s, int *typed) {
+    char *name = prog->strings + s->name;
+    void *var = NULL;
+    *typed = 0;
+
+    /* loop variables shadow the ones passed in, inner loops shadow outer ones */
+    for (int i = ctx->loops_size - 1; i >= 0 && var == NULL; i--) {
+        struct loop *loop = ctx->loops[i];
+        if (loop->key_hash == s->hash && loop->key_length == (size_t) s->length && memcmp(loop->key, name, s->length) == 0) {
+            var = loop->item;
+            *typed = loop->item_typed;
+        }
+    }
+    if (var == NULL && ctx->loops_size > 0 && s->length == 4 && memcmp(name, "loop", 4) == 0) {
+        if (s->last || (var = loop_var(ctx->loops[ctx->loops_size - 1], prog, s + 1)) == NULL) {
+            return NULL;
+        }
+        *typed = 1;
+        return resolve_path(ctx, prog, var, s + 1, typed);
+    }
+    if (var == NULL && ctx->vars != NULL) {
+        var = get_segment(ctx, ctx->vars, prog, s, typed);
+    }
+
+    return resolve_path(ctx, prog, var, s, typed);
+}
+
+static struct unja_object load_var(char *var, int typed) {
+    /* TODO: Handle unexisting symbols (returns NULL currently) */
+    if (var == NULL) {
+        return null_object;
+    }
+    if (!typed) {
+        return make_string_view(var, strlen(var));
+    }
+
+    struct unja_value *value = (struct unja_value *) var;
+    switch (value->type) {
+        case UNJA_INT:
+        case UNJA_BOOL: return make_int_object(value->integer);
+        case UNJA_FLOAT: return make_float_object(value->number);
+        case UNJA_STRING: return make_string_view(value->string, value->length);
+        case UNJA_LIST: return make_collection_object(OBJ_LIST, value->list->size);
+        case UNJA_MAP: return make_collection_object(OBJ_MAP, value->map->size);
+        case UNJA_ITER: break;
+    }
+
+    return null_object;
+}
+
+static struct unja_object load(struct context *ctx, struct program *prog, struct segment *s) {
+    int typed;
+    void *var = resolve(ctx, prog, s, &typed);
+    return load_var(var, typed);
+}
+
+/* load the path starting at segment s from the variable of the depth-th enclosing loop */
+static struct unja_object load_local(struct context *ctx, struct program *prog, struct segment *s, int depth) {
+    struct loop *loop = ctx->loops[ctx->loops_size - 1 - depth];
+    int typed = loop->item_typed;
+    void *var = resolve_path(ctx, prog, loop->item, s, &typed);
+    return load_var(var, typed);
+}
+
+static int loop_field(struct context *ctx, enum loop_field field) {
+    struct loop *loop = ctx->loops[ctx->loops_size - 1];
+    switch (field) {
+        case LOOP_INDEX: return loop->index.integer;
+        case LOOP_FIRST: return loop->first.integer;
+        case LOOP_LAST: return loop->last.integer;
+    }
+
+    return 0;
+}
+
+/* evaluate binary operator, storing the result in left */
+static void eval_infix_expression(struct arena *arena, struct unja_object *left, enum opcode op, struct unja_object *right) {
+    /* if both operands are of type string: use string operators */
+    if (left->type == OBJ_STRING && right->type == OBJ_STRING) {
+        switch (op) {
+            case OP_ADD: *left = concat_objects(arena, left, right); return;
+            case OP_EQ: *left = make_int_object(object_string_equals(left, right)); return;
+            case OP_NEQ: *left = make_int_object(!object_string_equals(left, right)); return;
+            default:
+                errx(EXIT_FAILURE, "invalid string operator");
+        }
+    }
+
+    if (left->type == OBJ_FLOAT || right->type == OBJ_FLOAT) {
+        double l = object_to_float(left);
+        double r = object_to_float(right);
+        switch (op) {
+            case OP_ADD: *left = make_float_object(l + r); return;
+            case OP_SUB: *left = make_float_object(l - r); return;
+            case OP_DIV: *left = make_float_object(l / r); return;
+            case OP_MUL: *left = make_float_object(l * r); return;
+            case OP_GT: *left = make_int_object(l > r); return;
+            case OP_GTE: *left = make_int_object(l >= r); return;
+            case OP_LT: *left = make_int_object(l < r); return;
+            case OP_LTE: *left = make_int_object(l <= r); return;
+            case OP_EQ: *left = make_int_object(l == r); return;
+            case OP_NEQ: *left = make_int_object(l != r); return;
+            default:
+                /* modulo of floats is taken of their integer parts */
+                break;
+        }
+    }
+
+    int l = object_to_int(left);
+    int r = object_to_int(right);
+    int result;
+    switch (op) {
+        case OP_ADD: result = l + r; break;
+        case OP_SUB: result = l - r; break;
+        case OP_DIV: result = l / r; break;
+        case OP_MUL: result = l * r; break;
+        case OP_MOD: result = l % r; break;
+        case OP_GT: result = l > r; break;
+        case OP_GTE: result = l >= r; break;
+        case OP_LT: result = l < r; break;
+        case OP_LTE: result = l <= r; break;
+        case OP_EQ: result = l == r; break;
+        case OP_NEQ: result = l != r; break;
+        default:
+            errx(EXIT_FAILURE, "invalid int operator");
+    }
+
+    *left = make_int_object(result);
+}
+
+static void loop_set_vars(struct context *ctx, struct loop *loop) {
+    loop->index.integer = loop->i;
+    loop->first.integer = loop->i == 0;
+    if (loop->list) {
+        loop->item = loop->list->values[loop->i];
+        loop->item_typed = loop->list->typed != NULL && loop->list->typed[loop->i];
+        loop->last.integer = loop->i == loop->size - 1;
+    } else if (loop->iter) {
+        loop->last.integer = loop->next == NULL;
+    } else {
+        loop->number.integer = loop->i;
+        loop->last.integer = loop->i == loop->size - 1;
+    }
+}
+
+/* start a loop, the caller sets where its items come from */
+static struct loop *loop_begin(struct context *ctx, char *key) {
+    if (ctx->loops_size == ctx->loops_cap) {
+        ctx->loops = arena_grow(ctx->arena, ctx->loops, &ctx->loops_cap, sizeof *ctx->loops);
+    }
+
+    struct loop *loop = ctx->loops[ctx->loops_size];
+    if (loop == NULL) {
+        loop = ctx->loops[ctx->loops_size] = arena_alloc(ctx->arena, sizeof *loop);
+        loop->key = NULL;
+        loop->index = (struct unja_value) { .type = UNJA_INT };
+        loop->first = (struct unja_value) { .type = UNJA_BOOL };
+        loop->last = (struct unja_value) { .type = UNJA_BOOL };
+        loop->number = (struct unja_value) { .type = UNJA_INT };
+    }
+    ctx->loops_size++;
+    loop->list = NULL;
+    loop->iter = NULL;
+    loop->item = &loop->number;
+    loop->item_typed = 1;
+    loop->i = 0;
+
+    /* a loop at the same depth usually runs with the same name again */
+    if (loop->key != key) {
+        loop->key = key;
+        loop->key_length = strlen(key);
+        loop->key_hash = hashmap_hash(key, loop->key_length);
+    }
+    return loop;
+}
+
+static void loop_end(struct context *ctx) {
+    ctx->loops_size--;
+}
+
+static void text(struct context *ctx, struct buffer *buf, char *str, size_t l, int trimmed) {
+    if (ctx->trim_next && !trimmed) {
+        while (l > 0 && isspace(*str)) {
+            str++;
+            l--;
+        }
+    }
+    ctx->trim_next = 0;
+    buffer_append_static(buf, str, l);
+}
+
+/* apply a filter to the value below its nargs arguments on top of the stack, popping the arguments */
+static void apply_filter(struct context *ctx, const char *name, const struct unja_filter *filter, int nargs) {
+    if (filter == NULL) {
+        errx(EXIT_FAILURE, "unknown filter: %s", name);
+    }
+    struct unja_object *args = &ctx->stack[ctx->stack_size - nargs];
+    filter->fn(ctx->arena, args - 1, args, nargs);
+    ctx->stack_size -= nargs;
+}
+
+/* start a loop over the list named by the path starting at segment s, returns 0 if there is nothing to loop over */
+static int for_begin(struct context *ctx, struct program *prog, struct segment *s, char *key) {
+    int typed;
+    struct vector *list = resolve(ctx, prog, s, &typed);
+    struct loop *loop;
+    if (list != NULL && typed) {
+        struct unja_value *value = (struct unja_value *) list;
+        if (value->type == UNJA_ITER) {
+            void *item = value->next(value->state);
+            if (item == NULL) {
+                return 0;
+            }
+
+            loop = loop_begin(ctx, key);
+            loop->iter = value;
+            loop->item = item;
+            loop->item_typed = 0;
+            loop->next = value->next(value->state);
+            loop_set_vars(ctx, loop);
+            return 1;
+        }
+        list = value->type == UNJA_LIST ? value->list : NULL;
+    }
+    if (list == NULL || list->size == 0) {
+        return 0;
+    }
+
+    loop = loop_begin(ctx, key);
+    loop->list = list;
+    loop->size = list->size;
+    loop_set_vars(ctx, loop);
+    return 1;
+}
+
+/* start a loop over the numbers 0 to count - 1, returns 0 if there are none */
+static int for_range(struct context *ctx, int count, char *key) {
+    if (count <= 0) {
+        return 0;
+    }
+
+    struct loop *loop = loop_begin(ctx, key);
+    loop->size = count;
+    loop_set_vars(ctx, loop);
+    return 1;
+}
+
+/* advance the innermost loop, returns 0 once it is done */
+static int for_next(struct context *ctx) {
+    struct loop *loop = ctx->loops[ctx->loops_size - 1];
+    loop->i++;
+    if (loop->iter) {
+        if (loop->next != NULL) {
+            loop->item = loop->next;
+            loop->next = loop->iter->next(loop->iter->state);
+            loop_set_vars(ctx, loop);
+            return 1;
+        }
+    } else if (loop->i < loop->size) {
+        loop_set_vars(ctx, loop);
+        return 1;
+    }
+
+    loop_end(ctx);
+    return 0;
+}
+
+/* 
+ * execute the instructions of prog in range [pc, end), timing each of them into sample if it is not NULL.
+ * always inlined into exec() and exec_profiled(), so renders that are not profiled do not check for it.
+ */
+static inline __attribute__((always_inline)) void run(struct context *ctx, struct buffer *buf, struct program *prog, int pc, int end, struct profile_sample *sample) {
+    struct instr *code = prog->code;
+    char *strings = prog->strings;
+    size_t executed = 0;
+
+    while (pc < end) {
+        struct instr *ins = &code[pc];
+        executed++;
+        if (sample) {
+            profile_tick(sample, pc);
+        }
+        switch (ins->op) {
+            case OP_TEXT:
+                text(ctx, buf, strings + ins->a, ins->b, ins->c);
+                pc++;
+            break;
+
+            case OP_PRINT:
+                eval_object(buf, &ctx->stack[--ctx->stack_size], ctx->autoescape);
+                pc++;
+            break;
+
+            case OP_PUSH_INT:
+                *push(ctx) = make_int_object(ins->a);
+                pc++;
+            break;
+
+            case OP_PUSH_STRING:
+                *push(ctx) = make_string_view(strings + ins->a, ins->b);
+                pc++;
+            break;
+
+            case OP_LOAD:
+                *push(ctx) = load(ctx, prog, &prog->segments[ins->a]);
+                pc++;
+            break;
+
+            case OP_LOAD_LOCAL:
+                *push(ctx) = load_local(ctx, prog, &prog->segments[ins->a], ins->b);
+                pc++;
+            break;
+
+            case OP_LOOP_FIELD:
+                *push(ctx) = make_int_object(loop_field(ctx, ins->a));
+                pc++;
+            break;
+
+            case OP_FILTER:
+                apply_filter(ctx, strings + ins->a, ctx->filters[ins->b], ins->c);
+                pc++;
+            break;
+
+            case OP_NOT: {
+                struct unja_object *obj = &ctx->stack[ctx->stack_size - 1];
+                *obj = make_int_object(!object_to_int(obj));
+                pc++;
+            }
+            break;
+
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_MOD:
+            case OP_GT:
+            case OP_GTE:
+            case OP_LT:
+            case OP_LTE:
+            case OP_EQ:
+            case OP_NEQ:
+                ctx->stack_size--;
+                eval_infix_expression(ctx->arena, &ctx->stack[ctx->stack_size - 1], ins->op, &ctx->stack[ctx->stack_size]);
+                pc++;
+            break;
+
+            case OP_JMP:
+                pc = ins->a;
+            break;
+
+            case OP_JMP_FALSE:
+                pc = object_is_truthy(&ctx->stack[--ctx->stack_size]) ? pc + 1 : ins->a;
+            break;
+
+            case OP_FOR_BEGIN:
+                pc = for_begin(ctx, prog, &prog->segments[ins->b], strings + ins->a) ? pc + 1 : ins->c;
+            break;
+
+            case OP_FOR_NEXT:
+                pc = for_next(ctx) ? ins->a : pc + 1;
+            break;
+
+            case OP_FOR_RANGE:
+                pc = for_range(ctx, object_to_int(&ctx->stack[--ctx->stack_size]), strings + ins->a) ? pc + 1 : ins->c;
+            break;
+
+            case OP_BLOCK:
+                /* blocks are resolved when linking and only kept as markers, a program that was not linked just renders the default body */
+                pc++;
+            break;
+
+            case OP_SET_TRIM:
+                ctx->trim_next = ins->a;
+                pc++;
+            break;
+
+            case OP_RTRIM:
+                buffer_rtrim(buf);
+                pc++;
+            break;
+
+            case OP_HALT:
+                pc = end;
+            break;
+        }
+    }
+
+    if (sample) {
+        profile_tick(sample, -1);
+    }
+    if (ctx->stats) {
+        ctx->stats->instructions += executed;
+    }
+}
+
+static void exec(struct context *ctx, struct buffer *buf, struct program *prog, int pc, int end) {
+    run(ctx, buf, prog, pc, end, NULL);
+}
+
+static void exec_profiled(struct context *ctx, struct buffer *buf, struct program *prog, int pc, int end) {
+    run(ctx, buf, prog, pc, end, ctx->profile);
+}
+
+static struct buffer buffer_new(struct sink *sink, struct iov_output *iov) {
+    struct buffer buf;
+    buf.size = 0;
+    buf.cap = 256;
+    buf.string = malloc(buf.cap);
+    if (!buf.string) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    count_alloc(buf.cap);
+    buf.string[0] = '\0';
+    buf.reallocs = 0;
+    buf.sink = sink;
+    buf.error = 0;
+    buf.iov = iov;
+    return buf;
+}
+
+/* render program into buffer, or stream it to sink or iov if either is not NULL */
+static struct buffer render_buffer(struct program *prog, struct context *ctx, struct sink *sink, struct iov_output *iov) {
+    struct buffer buf = buffer_new(sink, iov);
+    if (ctx->profile) {
+        exec_profiled(ctx, &buf, prog, 0, prog->size);
+    } else {
+        exec(ctx, &buf, prog, 0, prog->size);
+    }
+    if (ctx->stats) {
+        ctx->stats->peak_buffer_size = buf.cap;
+        ctx->stats->buffer_reallocs = buf.reallocs;
+    }
+    return buf;
+}
+
+char *render(struct program *prog, struct context *ctx) {
+    return render_buffer(prog, ctx, NULL, NULL).string;
+}
+
+/* render program to sink, returns 0 on success or -1 if the sink reported an error */
+int render_to_sink(struct program *prog, struct context *ctx, struct sink *sink) {
+    struct buffer buf = render_buffer(prog, ctx, sink, NULL);
+    sink_write(&buf, buf.string, buf.size);
+    free(buf.string);
+    return buf.error ? -1 : 0;
+}
+
+/* render program to a list of segments */
+void render_to_iov(struct program *prog, struct context *ctx, struct iov_output *out) {
+    out->iov = NULL;
+    out->iovcnt = 0;
+    out->iov_cap = 0;
+    out->scratch = NULL;
+    out->env = NULL;
+    out->template = NULL;
+    out->slot = 0;
+    struct buffer buf = render_buffer(prog, ctx, NULL, out);
+    free(buf.string);
+}
+
+void filter_trim(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    const char *str = object_string(obj);
+    size_t start = 0;
+    size_t end = obj->length;
+    while (start < end && isspace(str[start])) {
+        start++;
+    }
+    end = start + rtrimmed_length(str + start, end - start);
+
+    if (obj->storage == STR_INLINE) {
+        memmove(obj->small, obj->small + start, end - start);
+    } else {
+        obj->string += start;
+    }
+    obj->length = end - start;
+}
+
+void filter_lower(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    char *str = object_mutable_string(arena, obj);
+    for (size_t i=0; i < obj->length; i++) {
+        str[i] = tolower(str[i]);
+    }
+}
+
+void filter_wordcount(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    const char *str = object_string(obj);
+    int word_count = 1;
+    for (size_t i=0; i < obj->length; i++) {
+        if (isspace(str[i])) {
+            word_count++;
+        }
+    }
+
+    *obj = make_int_object(word_count);
+}
+
+/* number of characters of a string, or of items of a list or map */
+void filter_length(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    if (obj->type != OBJ_LIST && obj->type != OBJ_MAP) {
+        object_to_string(arena, obj);
+    }
+    *obj = make_int_object(obj->length);
+}
+
+/* escape a string for HTML and mark it safe, so that it is not escaped again */
+void filter_escape(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    if (obj->safe) {
+        return;
+    }
+
+    const char *str = object_string(obj);
+    size_t n = html_escape_span(str, obj->length);
+    if (n < obj->length) {
+        char *escaped = arena_alloc(arena, n + HTML_ESCAPE_MAX * (obj->length - n));
+        memcpy(escaped, str, n);
+        size_t l = n + html_escape(escaped + n, str + n, obj->length - n);
+        *obj = make_string_view(escaped, l);
+    }
+    obj->safe = 1;
+}
+
+/* cut a string to at most n bytes (255 by default), ending it with "..." if it was longer */
+void filter_truncate(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    int n = nargs > 0 ? object_to_int(&args[0]) : 255;
+    if (n < 0) {
+        n = 0;
+    }
+    if (obj->length <= (size_t) n) {
+        return;
+    }
+
+    /* markup that is cut off is no longer safe */
+    obj->safe = 0;
+    if (n <= 3) {
+        obj->length = n;
+        return;
+    }
+    struct unja_object ellipsis = make_string_view("...", 3);
+    obj->length = n - 3;
+    *obj = concat_objects(arena, obj, &ellipsis);
+}
+
+/* mark a string as markup that is output as it is, even if autoescaping is on */
+void filter_safe(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    obj->safe = 1;
+}
+
+/* arena kept between renders on the same thread, so that rendering does not need to allocate one every time */
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static void arena_key_destroy(void *arena) {
+    arena_free(arena);
+}
+
+static void arena_key_init() {
+    pthread_key_create(&arena_key, arena_key_destroy);
+}
+
+static struct arena *arena_acquire() {
+    pthread_once(&arena_key_once, arena_key_init);
+    struct arena *arena = pthread_getspecific(arena_key);
+    if (arena) {
+        /* take it, so that a render started from within this one (eg from a sink) gets its own */
+        pthread_setspecific(arena_key, NULL);
+        return arena;
+    }
+
+    return arena_new(RENDER_ARENA_SIZE);
+}
+
+static void arena_release(struct arena *arena) {
+    arena_reset(arena);
+    if (pthread_getspecific(arena_key) == NULL) {
+        pthread_setspecific(arena_key, arena);
+    } else {
+        arena_free(arena);
+    }
+}
+
+struct context context_new(struct hashmap *vars, int autoescape, const struct unja_filter **filters) {
+    struct context ctx;
+    ctx.filters = filters;
+    ctx.vars = vars;
+    ctx.autoescape = autoescape;
+    ctx.arena = arena_acquire();
+    ctx.stats = NULL;
+    ctx.profile = NULL;
+    ctx.trim_next = 0;
+    ctx.stack_size = 0;
+    ctx.stack_cap = 16;
+    ctx.stack = arena_alloc(ctx.arena, ctx.stack_cap * sizeof *ctx.stack);
+    ctx.loops_size = 0;
+    ctx.loops_cap = 4;
+    ctx.loops = arena_alloc(ctx.arena, ctx.loops_cap * sizeof *ctx.loops);
+    memset(ctx.loops, 0, ctx.loops_cap * sizeof *ctx.loops);
+    return ctx;
 }
 
 void context_free(struct context ctx) {
-    hashmap_free(ctx.filters);
+    arena_release(ctx.arena);
 }
 
 char *template_string(char *tmpl, struct hashmap *vars) {
     #if DEBUG
     printf("Template: %s\n", tmpl);
     #endif
-    struct mpc_ast_t *ast = parse(tmpl); 
-    struct context ctx = context_new(vars, NULL, NULL);     
-    char *output = render_ast(ast, &ctx);
-    mpc_ast_delete(ast);
+    struct parse_error error;
+    struct ast *ast = parse(tmpl, &error);
+    if (ast == NULL) {
+        warnx("%d:%d: %s", error.line, error.col, error.message);
+        return NULL;
+    }
+
+    struct program *prog = compile(ast);
+    ast_free(ast);
+    const struct unja_filter **filters = resolve_filters(NULL, prog);
+    struct context ctx = context_new(vars, 0, filters);
+    char *output = render(prog, &ctx);
+    program_free(prog);
     context_free(ctx);
+    free(filters);
     return output;
 }
 
-char *template(struct env *env, char *template_name, struct hashmap *vars) {
-    struct template *t = hashmap_get(env->templates, template_name);
+/* 
+ * find a template with its linked program, or report why it could not be linked and return NULL.
+ * the template stays valid until it is released with the slot stored in *slot.
+ */
+static struct template *acquire_template(struct env *env, char *template_name, int *slot) {
+    *slot = env_enter(env);
+    struct hashmap *templates = __atomic_load_n(&env->templates, __ATOMIC_SEQ_CST);
+    struct template *t = hashmap_get(templates, template_name);
+    if (t == NULL) {
+        errx(EXIT_FAILURE, "template \"%s\" does not exist", template_name);
+    }
+
+    /* in lazy mode, keep the template from being evicted until it is released */
+    if (env->lazy) {
+        pthread_mutex_lock(&env->lock);
+        if (t->linked != NULL) {
+            lru_touch(env, t);
+        } else if (load_lazily(env, t) == 0 && t->linked == NULL) {
+            warn_unlinked(templates, t);
+        }
+        if (t->linked != NULL) {
+            t->refs++;
+        }
+        lru_evict(env);
+        pthread_mutex_unlock(&env->lock);
+    } else if (t->linked == NULL) {
+        warn_unlinked(templates, t);
+    }
+
+    if (t->linked == NULL) {
+        env_leave(env, *slot);
+        return NULL;
+    }
+
     #if DEBUG
     printf("Template name: %s\n", t->name);
-    printf("Parent: %s\n", t->parent ? t->parent : "None");
+    printf("Parent: %s\n", t->program->parent ? t->program->parent : "None");
     #endif
+    return t;
+}
 
-    struct context ctx = context_new(vars, env, t); 
+static void release_template(struct env *env, struct template *t, int slot) {
+    if (env->lazy) {
+        pthread_mutex_lock(&env->lock);
+        t->refs--;
+        lru_evict(env);
+        pthread_mutex_unlock(&env->lock);
+    }
+    env_leave(env, slot);
+}
 
-    // find root template
-    while (t->parent != NULL) {
-        char *parent_name = t->parent;
-        t = hashmap_get(env->templates, parent_name);
+char *template(struct env *env, char *template_name, struct hashmap *vars) {
+    int slot;
+    struct template *t = acquire_template(env, template_name, &slot);
+    if (t == NULL) {
+        return NULL;
+    }
+    struct context ctx = context_new(vars, env->autoescape, t->filters);
+    char *output = render(t->linked, &ctx);
+    context_free(ctx);
+    release_template(env, t, slot);
+    return output;
+}
 
-        if (t == NULL) {
-            errx(EXIT_FAILURE, "template tried to extend unexisting parent \"%s\"", parent_name);
-            break;
-        }
+/* render a template like template(), filling stats with counters of the render */
+char *template_with_stats(struct env *env, char *template_name, struct hashmap *vars, struct render_stats *stats) {
+    memset(stats, 0, sizeof *stats);
+    int slot;
+    struct template *t = acquire_template(env, template_name, &slot);
+    if (t == NULL) {
+        return NULL;
     }
+    struct alloc_counter before = alloc_counter;
+    struct context ctx = context_new(vars, env->autoescape, t->filters);
+    ctx.stats = stats;
+    char *output = render(t->linked, &ctx);
+    stats->arena_allocations = ctx.arena->allocations;
+    stats->arena_bytes = ctx.arena->bytes;
+    context_free(ctx);
+    stats->allocations = alloc_counter.allocations - before.allocations;
+    stats->bytes_allocated = alloc_counter.bytes - before.bytes;
+    release_template(env, t, slot);
+    return output;
+}
 
-   
-    char *output = render_ast(t->ast, &ctx);
+/* render a template like template(), adding the time spent in each of its lines, loops and blocks to profile */
+char *template_profile(struct env *env, char *template_name, struct hashmap *vars, struct profile *profile) {
+    int slot;
+    struct template *t = acquire_template(env, template_name, &slot);
+    if (t == NULL) {
+        return NULL;
+    }
+    struct program *prog = t->linked;
+    struct context ctx = context_new(vars, env->autoescape, t->filters);
+    struct profile_sample sample;
+    sample.counts = arena_alloc(ctx.arena, prog->size * sizeof *sample.counts);
+    sample.ns = arena_alloc(ctx.arena, prog->size * sizeof *sample.ns);
+    memset(sample.counts, 0, prog->size * sizeof *sample.counts);
+    memset(sample.ns, 0, prog->size * sizeof *sample.ns);
+    sample.pc = -1;
+    ctx.profile = &sample;
+    char *output = render(prog, &ctx);
+    profile_add(profile, t->name, prog, &sample);
     context_free(ctx);
+    release_template(env, t, slot);
     return output;
-}
\ No newline at end of file
+}
+
+int template_stream(struct env *env, char *template_name, struct hashmap *vars, struct sink sink) {
+    int slot;
+    struct template *t = acquire_template(env, template_name, &slot);
+    if (t == NULL) {
+        return -1;
+    }
+    struct context ctx = context_new(vars, env->autoescape, t->filters);
+    int ret = render_to_sink(t->linked, &ctx, &sink);
+    context_free(ctx);
+    release_template(env, t, slot);
+    return ret;
+}
+
+void template_iov(struct env *env, char *template_name, struct hashmap *vars, struct iov_output *out) {
+    int slot;
+    struct template *t = acquire_template(env, template_name, &slot);
+    if (t == NULL) {
+        memset(out, 0, sizeof *out);
+        return;
+    }
+    struct context ctx = context_new(vars, env->autoescape, t->filters);
+    render_to_iov(t->linked, &ctx, out);
+    context_free(ctx);
+
+    /* segments point into the program, so it is released together with the output */
+    out->env = env;
+    out->template = t;
+    out->slot = slot;
+}
+
+void iov_output_free(struct iov_output *out) {
+    if (out->env) {
+        release_template(out->env, out->template, out->slot);
+        out->env = NULL;
+        out->template = NULL;
+    }
+
+    struct scratch *chunk = out->scratch;
+    while (chunk) {
+        struct scratch *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(out->iov);
+    out->iov = NULL;
+    out->iovcnt = 0;
+    out->scratch = NULL;
+}
+
+/* state of a render by a template compiled to C */
+struct compiled_render {
+    struct context ctx;
+    struct buffer buf;
+
+    /* env the template was rendered with, which may be NULL */
+    struct env *env;
+};
+
+static int compare_compiled(const void *name, const void *t) {
+    return strcmp(name, ((const struct compiled_template *) t)->name);
+}
+
+/* render one of the compiled templates, which are sorted by name, falling back to env if it is not among them */
+char *compiled_render_template(const struct compiled_template *templates, int n, int autoescape, struct env *env, char *template_name, struct hashmap *vars) {
+    const struct compiled_template *t = bsearch(template_name, templates, n, sizeof *templates, compare_compiled);
+    if (t == NULL) {
+        if (env == NULL) {
+            errx(EXIT_FAILURE, "template \"%s\" does not exist", template_name);
+        }
+        return template(env, template_name, vars);
+    }
+
+    struct compiled_render r;
+    r.ctx = context_new(vars, autoescape, NULL);
+    r.env = env;
+    r.buf = buffer_new(NULL, NULL);
+    t->render(&r);
+    context_free(r.ctx);
+    return r.buf.string;
+}
+
+void compiled_text(struct compiled_render *r, const char *str, size_t l, int trimmed) {
+    text(&r->ctx, &r->buf, (char *) str, l, trimmed);
+}
+
+void compiled_print(struct compiled_render *r, struct unja_object *obj) {
+    eval_object(&r->buf, obj, r->ctx.autoescape);
+}
+
+struct unja_object compiled_load(struct compiled_render *r, struct program *prog, int segment) {
+    return load(&r->ctx, prog, &prog->segments[segment]);
+}
+
+struct unja_object compiled_load_local(struct compiled_render *r, struct program *prog, int segment, int depth) {
+    return load_local(&r->ctx, prog, &prog->segments[segment], depth);
+}
+
+int compiled_loop_field(struct compiled_render *r, enum loop_field field) {
+    return loop_field(&r->ctx, field);
+}
+
+/* filter by name for a render, which compiled templates look up once before they use it. NULL if there is none. */
+const struct unja_filter *compiled_find_filter(struct compiled_render *r, const char *name) {
+    return find_filter(r->env, name);
+}
+
+/* apply a filter that is not known at compile time */
+void compiled_filter(struct compiled_render *r, const char *name, const struct unja_filter *filter, struct unja_object *obj, struct unja_object *args, int nargs) {
+    if (filter == NULL) {
+        errx(EXIT_FAILURE, "unknown filter: %s", name);
+    }
+    filter->fn(r->ctx.arena, obj, args, nargs);
+}
+
+void compiled_binary(struct compiled_render *r, struct unja_object *left, enum opcode op, struct unja_object *right) {
+    eval_infix_expression(r->ctx.arena, left, op, right);
+}
+
+int compiled_for_begin(struct compiled_render *r, struct program *prog, int segment, char *key) {
+    return for_begin(&r->ctx, prog, &prog->segments[segment], key);
+}
+
+int compiled_for_range(struct compiled_render *r, int count, char *key) {
+    return for_range(&r->ctx, count, key);
+}
+
+int compiled_for_next(struct compiled_render *r) {
+    return for_next(&r->ctx);
+}
+
+void compiled_set_trim(struct compiled_render *r, int trim) {
+    r->ctx.trim_next = trim;
+}
+
+void compiled_rtrim(struct compiled_render *r) {
+    buffer_rtrim(&r->buf);
+}
+
+struct arena *compiled_arena(struct compiled_render *r) {
+    return r->ctx.arena;
+}
+
+static int write_file(const char *data, size_t len, void *f) {
+    return fwrite(data, 1, len, f) == len ? 0 : -1;
+}
+
+/* sink writing to a stdio stream */
+struct sink sink_file(FILE *f) {
+    struct sink sink = {
+        .write = write_file,
+        .data = f,
+    };
+    return sink;
+}
+
+static int write_fd(const char *data, size_t len, void *fd) {
+    while (len > 0) {
+        ssize_t n = write((int)(intptr_t) fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* sink writing to a file descriptor */
+struct sink sink_fd(int fd) {
+    struct sink sink = {
+        .write = write_fd,
+        .data = (void *)(intptr_t) fd,
+    };
+    return sink;
+}
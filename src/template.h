@@ -1,10 +1,145 @@
+#include <stdio.h>
+#include <sys/uio.h>
 #include "hashmap.h"
 #include "vector.h"
+#include "value.h"
 
+/* receives rendered output in chunks. write should return 0 on success, -1 on error. */
+struct sink {
+    int (*write)(const char *buf, size_t len, void *data);
+    void *data;
+};
 
+
+/* 
+ * Output as a list of segments, ready for writev(). Segments of template text point into the env
+ * and stay valid as long as it does, other segments stay valid until iov_output_free() is called.
+ */
+struct iov_output {
+    struct iovec *iov;
+    int iovcnt;
+
+    /* private */
+    int iov_cap;
+    struct scratch *scratch;
+    struct env *env;
+    struct template *template;
+    int slot;
+};
+
+struct arena;
+struct unja_object;
+
+/*
+ * Filter applied as {{ value | name }} or {{ value | name(arg, ...) }}, replacing the value in obj.
+ * args holds the nargs arguments, evaluated like any expression. See object.h for working with values,
+ * strings returned by a filter are best allocated from arena, which lives as long as the render.
+ */
+struct unja_filter {
+    const char *name;
+    void (*fn)(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs);
+};
+
+/* options for env_new_with_options() */
+struct env_options {
+    /* number of threads reading and compiling templates, 0 for one per online CPU */
+    int threads;
+
+    /* also load templates from subdirectories, named by their path relative to the directory (eg "emails/welcome.tmpl") */
+    int recursive;
+
+    /* only index template names, compiling templates when they are first rendered */
+    int lazy;
+
+    /* lazy mode: evict least recently used templates once compiled templates take more than this many bytes, 0 for no limit */
+    size_t cache_size;
+
+    /* file to load compiled templates from, if they are up to date, and to store them in otherwise. NULL for none. */
+    char *cache_file;
+
+    /* escape strings for HTML when they are output, unless they are marked with the safe filter */
+    int autoescape;
+
+    /* filters available to templates besides the builtin ones, whose names they can not take */
+    const struct unja_filter *filters;
+    int nfilters;
+};
+
+/* counters of a single render, see template_with_stats() */
+struct render_stats {
+    /* heap allocations made by the render, including its output, and the number of bytes they requested */
+    size_t allocations;
+    size_t bytes_allocated;
+
+    /* allocations from the render's arena, which are cheap and released all at once when it is done */
+    size_t arena_allocations;
+    size_t arena_bytes;
+
+    /* capacity of the output buffer at its largest, and the number of times it had to grow */
+    size_t peak_buffer_size;
+    size_t buffer_reallocs;
+
+    /* instructions executed, and hashmap slots inspected while looking up variables */
+    size_t instructions;
+    size_t hashmap_probes;
+};
+
+/* memory held by an env, see env_stats() */
+struct env_stats {
+    int templates;
+
+    /* number of templates that are compiled, which is all of them unless the env is lazy */
+    int compiled;
+
+    /* bytes used by instructions, string pools and variable names of compiled and linked programs */
+    size_t program_bytes;
+
+    /* bytes used by the maps of block names to their position */
+    size_t block_bytes;
+
+    /* bytes used by template names and the map of templates */
+    size_t name_bytes;
+    size_t index_bytes;
+
+    /* bytes of programs used in place from the cache file, which are not part of program_bytes */
+    size_t mapped_bytes;
+};
+
+/* 
+ * time spent rendering, aggregated over any number of renders by template_profile() per template line, 
+ * loop and block. a profile can be shared by renders on multiple threads.
+ */
+struct profile;
+struct profile *profile_new();
+void profile_report(struct profile *profile, FILE *f);
+void profile_write_folded(struct profile *profile, FILE *f);
+void profile_free(struct profile *profile);
+
+/*
+ * An env is not modified after env_new() returns (apart from the internally locked cache of a lazy env and
+ * reloads, which never block renders), so it can be rendered from any number of threads at once.
+ * The variables passed to a render are only read, so they can be shared between concurrent renders as well.
+ */
 struct env;
-struct env *env_new();
+struct env *env_new(char *dirname);
+struct env *env_new_with_options(char *dirname, struct env_options *options);
+int env_reload(struct env *env, char **names, int n);
+int env_watch(struct env *env);
+void env_stats(struct env *env, struct env_stats *stats);
 void env_free(struct env *env);
+
+/*
+ * Rendering a template that extends a missing template, or whose chain of parents is too deep or extends itself,
+ * reports why and returns NULL (-1 from template_stream(), no segments from template_iov()). So does rendering
+ * a template of a lazy env that fails to compile.
+ */
 char *template(struct env *env, char *template_name, struct hashmap *ctx);
 char *template_string(char *tmpl, struct hashmap *ctx);
+char *template_with_stats(struct env *env, char *template_name, struct hashmap *vars, struct render_stats *stats);
+char *template_profile(struct env *env, char *template_name, struct hashmap *vars, struct profile *profile);
+int template_stream(struct env *env, char *template_name, struct hashmap *ctx, struct sink sink);
+void template_iov(struct env *env, char *template_name, struct hashmap *ctx, struct iov_output *out);
+void iov_output_free(struct iov_output *out);
+struct sink sink_file(FILE *f);
+struct sink sink_fd(int fd);
 char *read_file(char *filename);
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "value.h"
+
+static struct unja_value *value_new(enum unja_value_type type) {
+    struct unja_value *value = calloc(1, sizeof *value);
+    if (!value) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    value->type = type;
+    return value;
+}
+
+struct unja_value *unja_value_int(int integer) {
+    struct unja_value *value = value_new(UNJA_INT);
+    value->integer = integer;
+    return value;
+}
+
+/* booleans render and compare as 1 or 0 */
+struct unja_value *unja_value_bool(int boolean) {
+    struct unja_value *value = value_new(UNJA_BOOL);
+    value->integer = boolean != 0;
+    return value;
+}
+
+struct unja_value *unja_value_float(double number) {
+    struct unja_value *value = value_new(UNJA_FLOAT);
+    value->number = number;
+    return value;
+}
+
+struct unja_value *unja_value_str(const char *str) {
+    return unja_value_str_n(str, strlen(str));
+}
+
+/* string of the given length, which does not need to be NUL-terminated */
+struct unja_value *unja_value_str_n(const char *str, size_t length) {
+    struct unja_value *value = value_new(UNJA_STRING);
+    value->string = str;
+    value->length = length;
+    return value;
+}
+
+struct unja_value *unja_value_list(struct vector *list) {
+    struct unja_value *value = value_new(UNJA_LIST);
+    value->list = list;
+    return value;
+}
+
+struct unja_value *unja_value_map(struct hashmap *map) {
+    struct unja_value *value = value_new(UNJA_MAP);
+    value->map = map;
+    return value;
+}
+
+/* iterator producing the items of a for loop, see value.h */
+struct unja_value *unja_value_iter(void *(*next)(void *state), void *state) {
+    struct unja_value *value = value_new(UNJA_ITER);
+    value->next = next;
+    value->state = state;
+    return value;
+}
+
+/* free a value, but not the string, list or map it references */
+void unja_value_free(struct unja_value *value) {
+    free(value);
+}
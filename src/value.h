@@ -0,0 +1,47 @@
+/*
+ * Typed values for template variables. A variable is either a plain NUL-terminated string, a struct vector of
+ * variables or a struct hashmap of variables, or one of these. Typed values are inserted into a hashmap with
+ * hashmap_insert_value() and pushed to a vector with vector_push_value(), which flag them as typed, so any
+ * string can be passed as it is. Strings, lists and maps are referenced, not copied, so they have to outlive the value.
+ *
+ * An iterator produces the items of a for loop one at a time, so they do not have to be in memory at once.
+ * next is called with state until it returns NULL, always one item ahead to know which item is the last.
+ * So an item has to stay valid until the call after the one that returned it. An iterator can be looped over once.
+ * Its items are plain variables, typed values can be put in the hashmaps it produces.
+ */
+#include <stddef.h>
+
+struct vector;
+struct hashmap;
+
+enum unja_value_type {
+    UNJA_INT,
+    UNJA_BOOL,
+    UNJA_FLOAT,
+    UNJA_STRING,
+    UNJA_LIST,
+    UNJA_MAP,
+    UNJA_ITER,
+};
+
+struct unja_value {
+    enum unja_value_type type;
+    int integer;
+    double number;
+    const char *string;
+    size_t length;
+    struct vector *list;
+    struct hashmap *map;
+    void *(*next)(void *state);
+    void *state;
+};
+
+struct unja_value *unja_value_int(int value);
+struct unja_value *unja_value_bool(int value);
+struct unja_value *unja_value_float(double value);
+struct unja_value *unja_value_str(const char *str);
+struct unja_value *unja_value_str_n(const char *str, size_t length);
+struct unja_value *unja_value_list(struct vector *list);
+struct unja_value *unja_value_map(struct hashmap *map);
+struct unja_value *unja_value_iter(void *(*next)(void *state), void *state);
+void unja_value_free(struct unja_value *value);
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <err.h>
 #include "vector.h"
 
 /* create a new vector of the given capacity */
@@ -7,17 +8,52 @@ struct vector* vector_new(int cap) {
     l->size = 0;
     l->cap = cap;
     l->values = malloc(l->cap * sizeof *l->values);
+    l->typed = NULL;
     return l;
 }
 
-/* push a new value to the end of the vector's memory */
-int vector_push(struct vector *vec, void *value) {
+/* append value flagged as a struct unja_value or not, growing the vector if needed */
+static int push(struct vector *vec, void *value, int typed) {
+    if (vec->size == vec->cap) {
+        vec->cap = vec->cap > 0 ? vec->cap * 2 : 8;
+        vec->values = realloc(vec->values, vec->cap * sizeof *vec->values);
+        if (!vec->values) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+        if (vec->typed) {
+            vec->typed = realloc(vec->typed, vec->cap);
+            if (!vec->typed) {
+                err(EXIT_FAILURE, "out of memory");
+            }
+        }
+    }
+    if (typed && !vec->typed) {
+        vec->typed = calloc(vec->cap, 1);
+        if (!vec->typed) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    if (vec->typed) {
+        vec->typed[vec->size] = typed;
+    }
     vec->values[vec->size++] = value;
     return vec->size - 1;
 }
 
+/* push a new value to the end of the vector's memory, growing it if needed */
+int vector_push(struct vector *vec, void *value) {
+    return push(vec, value, 0);
+}
+
+/* like vector_push(), for a typed template variable */
+int vector_push_value(struct vector *vec, struct unja_value *value) {
+    return push(vec, value, 1);
+}
+
 /* free vector related memory */
 void vector_free(struct vector *l) {
     free(l->values);
+    free(l->typed);
     free(l);
 }
\ No newline at end of file
@@ -1,11 +1,17 @@
 #include <stdlib.h>
 
+struct unja_value;
+
 struct vector {
     void **values;
     int size;
     int cap;
+
+    /* whether each value is a struct unja_value, NULL until one is pushed */
+    unsigned char *typed;
 };
 
 struct vector* vector_new(int cap);
 int vector_push(struct vector *vec, void *value);
+int vector_push_value(struct vector *vec, struct unja_value *value);
 void vector_free(struct vector *vec);
\ No newline at end of file
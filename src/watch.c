@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+/* time to wait for more events before reporting a batch of changes, in milliseconds */
+#define WATCH_SETTLE_TIME 50
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+struct watch {
+    int wd;
+
+    /* directory relative to the watched one, "" for the directory itself */
+    char *subdir;
+};
+
+struct watcher {
+    char *dirname;
+    int recursive;
+    void (*on_change)(char **names, int n, void *data);
+    void *data;
+
+    int fd;
+    struct watch *watches;
+    int nwatches;
+
+    /* written to by watcher_free() to stop the thread */
+    int stop[2];
+    pthread_t thread;
+    int running;
+
+    /* names changed in the current batch */
+    char **names;
+    int nnames;
+    int names_cap;
+};
+
+static char *join(const char *a, const char *b) {
+    char *path = malloc(strlen(a) + strlen(b) + 2);
+    if (!path) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    sprintf(path, "%s%s%s", a, *a && *b ? "/" : "", b);
+    return path;
+}
+
+static void add_name(struct watcher *w, char *name) {
+    for (int i=0; i < w->nnames; i++) {
+        if (strcmp(w->names[i], name) == 0) {
+            free(name);
+            return;
+        }
+    }
+
+    if (w->nnames == w->names_cap) {
+        w->names_cap = w->names_cap ? w->names_cap * 2 : 16;
+        w->names = realloc(w->names, w->names_cap * sizeof *w->names);
+        if (!w->names) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+    }
+    w->names[w->nnames++] = name;
+}
+
+/* report subdir and everything below it as changed */
+static void add_dir_name(struct watcher *w, const char *subdir) {
+    char *name = malloc(strlen(subdir) + 2);
+    if (!name) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    sprintf(name, "%s%s", subdir, *subdir ? "/" : "");
+    add_name(w, name);
+}
+
+static struct watch *find_watch(struct watcher *w, int wd) {
+    for (int i=0; i < w->nwatches; i++) {
+        if (w->watches[i].wd == wd) {
+            return &w->watches[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* watch dirname/subdir and, if recursive, its subdirectories. files found are reported as changed if report is set. */
+static void add_watch(struct watcher *w, const char *subdir, int report) {
+    char *dir = join(w->dirname, subdir);
+    int wd = inotify_add_watch(w->fd, dir, WATCH_MASK);
+    if (wd < 0) {
+        warn("could not watch \"%s\"", dir);
+        free(dir);
+        return;
+    }
+
+    /* a directory that is watched already, when scanning again, may have been moved without us knowing */
+    struct watch *watch = find_watch(w, wd);
+    if (watch != NULL) {
+        free(watch->subdir);
+    } else {
+        w->watches = realloc(w->watches, (w->nwatches + 1) * sizeof *w->watches);
+        if (!w->watches) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+        watch = &w->watches[w->nwatches++];
+        watch->wd = wd;
+    }
+    watch->subdir = join(subdir, "");
+
+    DIR *dr = opendir(dir);
+    struct dirent *de;
+    while (dr && (de = readdir(dr)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+
+        char *name = join(subdir, de->d_name);
+        char *path = join(w->dirname, name);
+        struct stat st;
+        int is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        free(path);
+
+        if (is_dir && w->recursive) {
+            add_watch(w, name, report);
+        }
+        if (!is_dir && report) {
+            add_name(w, name);
+        } else {
+            free(name);
+        }
+    }
+
+    if (dr) {
+        closedir(dr);
+    }
+    free(dir);
+}
+
+/* stop watching subdir and the directories below it */
+static void remove_watches(struct watcher *w, const char *subdir) {
+    size_t length = strlen(subdir);
+    for (int i=0; i < w->nwatches; i++) {
+        char *s = w->watches[i].subdir;
+        if (length > 0 && (strncmp(s, subdir, length) != 0 || (s[length] != '\0' && s[length] != '/'))) {
+            continue;
+        }
+
+        /* the kernel drops the watch of a directory that is deleted by itself */
+        inotify_rm_watch(w->fd, w->watches[i].wd);
+        free(s);
+        w->watches[i--] = w->watches[--w->nwatches];
+    }
+}
+
+/* read pending events, collecting the names of changed files */
+static void read_events(struct watcher *w) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(w->fd, buf, sizeof buf);
+
+    for (char *ptr = buf; len > 0 && ptr < buf + len; ) {
+        struct inotify_event *ev = (struct inotify_event *) ptr;
+        ptr += sizeof *ev + ev->len;
+
+        /* events were lost, so every template may have changed and directories may be new or gone */
+        if (ev->mask & IN_Q_OVERFLOW) {
+            add_watch(w, "", 1);
+            add_dir_name(w, "");
+            continue;
+        }
+
+        struct watch *watch = find_watch(w, ev->wd);
+        if (watch == NULL) {
+            continue;
+        }
+
+        /* the directory itself was deleted or unmounted, taking its templates with it */
+        if (ev->mask & IN_IGNORED) {
+            char *subdir = join(watch->subdir, "");
+            add_dir_name(w, subdir);
+            remove_watches(w, subdir);
+            free(subdir);
+            continue;
+        }
+        if (ev->len == 0 || ev->name[0] == '.') {
+            continue;
+        }
+
+        char *name = join(watch->subdir, ev->name);
+        if (ev->mask & IN_ISDIR) {
+            /* files in a directory that is moved away do not generate events of their own either */
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                add_dir_name(w, name);
+                remove_watches(w, name);
+            }
+
+            /* files in a new directory do not generate events of their own */
+            if (w->recursive && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                add_watch(w, name, 1);
+            }
+            free(name);
+            continue;
+        }
+
+        /* a newly created file is reported once it is written and closed */
+        if ((ev->mask & IN_CREATE) && !(ev->mask & IN_MOVED_TO)) {
+            free(name);
+            continue;
+        }
+
+        add_name(w, name);
+    }
+}
+
+static void *watch_loop(void *arg) {
+    struct watcher *w = arg;
+    struct pollfd fds[2] = {
+        { .fd = w->fd, .events = POLLIN },
+        { .fd = w->stop[0], .events = POLLIN },
+    };
+
+    while (1) {
+        /* wait for changes, then keep collecting until things settle down */
+        int timeout = w->nnames > 0 ? WATCH_SETTLE_TIME : -1;
+        int ret = poll(fds, 2, timeout);
+        if (ret < 0 || fds[1].revents) {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            read_events(w);
+            continue;
+        }
+
+        if (ret == 0 && w->nnames > 0) {
+            w->on_change(w->names, w->nnames, w->data);
+            for (int i=0; i < w->nnames; i++) {
+                free(w->names[i]);
+            }
+            w->nnames = 0;
+        }
+    }
+
+    return NULL;
+}
+
+/* start watching dirname, returns NULL if watching is not possible */
+struct watcher *watcher_new(char *dirname, int recursive, void (*on_change)(char **names, int n, void *data), void *data) {
+    struct watcher *w = calloc(1, sizeof *w);
+    if (!w) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    w->dirname = join(dirname, "");
+    w->recursive = recursive;
+    w->on_change = on_change;
+    w->data = data;
+    w->fd = inotify_init();
+    if (w->fd < 0 || pipe(w->stop) != 0) {
+        if (w->fd >= 0) {
+            close(w->fd);
+        }
+        free(w->dirname);
+        free(w);
+        return NULL;
+    }
+
+    add_watch(w, "", 0);
+    if (pthread_create(&w->thread, NULL, watch_loop, w) != 0) {
+        watcher_free(w);
+        return NULL;
+    }
+    w->running = 1;
+
+    return w;
+}
+
+void watcher_free(struct watcher *w) {
+    if (w->running) {
+        if (write(w->stop[1], "", 1) != 1) {
+            warn("could not stop watching \"%s\"", w->dirname);
+        }
+        pthread_join(w->thread, NULL);
+    }
+
+    for (int i=0; i < w->nwatches; i++) {
+        free(w->watches[i].subdir);
+    }
+    for (int i=0; i < w->nnames; i++) {
+        free(w->names[i]);
+    }
+    free(w->watches);
+    free(w->names);
+    close(w->fd);
+    close(w->stop[0]);
+    close(w->stop[1]);
+    free(w->dirname);
+    free(w);
+}
+
+#else
+
+/* no way to watch for changes on this platform */
+struct watcher *watcher_new(char *dirname, int recursive, void (*on_change)(char **names, int n, void *data), void *data) {
+    return NULL;
+}
+
+void watcher_free(struct watcher *w) {
+}
+
+#endif
@@ -0,0 +1,11 @@
+/* 
+ * Watches a directory of templates for changes from a background thread.
+ * on_change is called from that thread with the names (relative to the directory) of files that were
+ * created, modified or removed. Changes arriving in quick succession are passed in a single call.
+ * A directory that was removed is passed as its name followed by a slash, meaning any file below it may be gone.
+ * If events were lost, the tree is scanned again and passed as an empty name, meaning any file may have changed.
+ */
+struct watcher;
+
+struct watcher *watcher_new(char *dirname, int recursive, void (*on_change)(char **names, int n, void *data), void *data);
+void watcher_free(struct watcher *w);
@@ -0,0 +1,163 @@
+#include "test.h"
+#include "template.h"
+#include "object.h"
+
+/* generated by unja-compile from directories in tests/data, see Makefile */
+char *autoescape(struct env *env, char *template_name, struct hashmap *vars);
+char *filters(struct env *env, char *template_name, struct hashmap *vars);
+char *compiled(struct env *env, char *template_name, struct hashmap *vars);
+char *inheritance_depth_2(struct env *env, char *template_name, struct hashmap *vars);
+char *inheritance_nested(struct env *env, char *template_name, struct hashmap *vars);
+char *template_with_logic(struct env *env, char *template_name, struct hashmap *vars);
+
+/* check that a compiled template renders exactly like the interpreted one */
+static void assert_same_output(char *dirname, char *(*fn)(struct env *, char *, struct hashmap *), char *name, struct hashmap *vars) {
+    struct env *env = env_new(dirname);
+    char *expected = template(env, name, vars);
+    char *output = fn(NULL, name, vars);
+    assert(strcmp(output, expected) == 0, "%s/%s: expected \"%s\", got \"%s\"", dirname, name, expected, output);
+    free(output);
+    free(expected);
+    env_free(env);
+}
+
+/* filter repeating a string as many times as its argument says */
+void filter_repeat(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    int n = nargs > 0 ? object_to_int(&args[0]) : 1;
+    struct unja_object once = *obj;
+    *obj = make_string_view("", 0);
+    for (int i=0; i < n; i++) {
+        *obj = concat_objects(arena, obj, &once);
+    }
+}
+
+START_TESTS
+
+TEST(compiled_inheritance) {
+    assert_same_output("./tests/data/inheritance-depth-2", inheritance_depth_2, "base.tmpl", NULL);
+    assert_same_output("./tests/data/inheritance-depth-2", inheritance_depth_2, "one.tmpl", NULL);
+    assert_same_output("./tests/data/inheritance-depth-2", inheritance_depth_2, "two.tmpl", NULL);
+    char *output = inheritance_depth_2(NULL, "two.tmpl", NULL);
+    assert_str(output, "0\n1\n2\n");
+    free(output);
+}
+
+TEST(compiled_nested_blocks) {
+    struct hashmap *vars = hashmap_new();
+    struct vector *items = vector_new(2);
+    vector_push(items, "a");
+    vector_push(items, "b");
+    hashmap_insert(vars, "items", items);
+    assert_same_output("./tests/data/inheritance-nested", inheritance_nested, "base.tmpl", vars);
+    assert_same_output("./tests/data/inheritance-nested", inheritance_nested, "one.tmpl", vars);
+    assert_same_output("./tests/data/inheritance-nested", inheritance_nested, "two.tmpl", vars);
+    assert_same_output("./tests/data/inheritance-nested", inheritance_nested, "three.tmpl", vars);
+    assert_same_output("./tests/data/inheritance-nested", inheritance_nested, "four.tmpl", vars);
+
+    /* an empty loop jumps past its body */
+    items->size = 0;
+    assert_same_output("./tests/data/inheritance-nested", inheritance_nested, "two.tmpl", vars);
+    items->size = 2;
+    vector_free(items);
+    hashmap_free(vars);
+}
+
+TEST(compiled_logic) {
+    assert_same_output("./tests/data/template-with-logic", template_with_logic, "child.tmpl", NULL);
+}
+
+TEST(compiled_expressions) {
+    struct hashmap *vars = hashmap_new();
+    struct hashmap *user = hashmap_new();
+    struct vector *items = vector_new(3);
+    vector_push(items, "One");
+    vector_push(items, "TWO");
+    vector_push(items, "three");
+    hashmap_insert(vars, "items", items);
+    hashmap_insert(vars, "title", "  Hello there ");
+    hashmap_insert(user, "name", "Danny");
+    hashmap_insert(user, "email", "danny@example.com");
+    hashmap_insert(vars, "user", user);
+    assert_same_output("./tests/data/compiled", compiled, "page.tmpl", vars);
+
+    hashmap_insert(vars, "title", "0");
+    hashmap_remove(vars, "items");
+    assert_same_output("./tests/data/compiled", compiled, "page.tmpl", vars);
+
+    /* arithmetic on a float results in a float, which is not known at compile time */
+    struct unja_value *price = unja_value_float(9.5);
+    hashmap_insert_value(vars, "price", price);
+    assert_same_output("./tests/data/compiled", compiled, "page.tmpl", vars);
+    char *output = compiled(NULL, "page.tmpl", vars);
+    assert(strstr(output, "19.0 more expensive") != NULL, "expected float arithmetic, got \"%s\"", output);
+
+    /* negative numbers are falsy, also when they are known to be integers at compile time */
+    assert(strstr(output, "negative") == NULL, "expected negative condition to be false, got \"%s\"", output);
+    free(output);
+
+    unja_value_free(price);
+    vector_free(items);
+    hashmap_free(user);
+    hashmap_free(vars);
+}
+
+TEST(compiled_fallback) {
+    struct env *env = env_new("./tests/data/inheritance-depth-1");
+    char *output = inheritance_nested(env, "one.tmpl", NULL);
+    assert_str(output, "<>");
+    free(output);
+
+    /* templates that were not compiled are rendered from the env */
+    output = template_with_logic(env, "one.tmpl", NULL);
+    assert_str(output, "Header\nChild content\nFooter\n");
+    free(output);
+    env_free(env);
+}
+
+TEST(compiled_user_filters) {
+    struct unja_filter user_filters[] = {
+        { "repeat", filter_repeat },
+    };
+    struct env_options options = {
+        .recursive = 1,
+        .filters = user_filters,
+        .nfilters = 1,
+    };
+    struct env *env = env_new_with_options("./tests/data/filters", &options);
+    struct hashmap *vars = hashmap_new();
+    hashmap_insert(vars, "name", "Hello");
+
+    /* filters that are not builtin are taken from the env passed to the compiled template */
+    char *expected = template(env, "page.tmpl", vars);
+    char *output = filters(env, "page.tmpl", vars);
+    assert_str(output, expected);
+    free(output);
+    free(expected);
+    hashmap_free(vars);
+    env_free(env);
+}
+
+TEST(compiled_autoescape) {
+    struct env_options options = {
+        .recursive = 1,
+        .autoescape = 1,
+    };
+    struct env *env = env_new_with_options("./tests/data/autoescape", &options);
+    struct hashmap *vars = hashmap_new();
+    hashmap_insert(vars, "title", "\"quoted\" & 'single'");
+    hashmap_insert(vars, "body", "<script>alert(1)</script>");
+    hashmap_insert(vars, "html", "<b>bold</b>");
+    hashmap_insert(vars, "count", "3");
+
+    char *expected = template(env, "page.tmpl", vars);
+    char *output = autoescape(NULL, "page.tmpl", vars);
+    assert_str(output, expected);
+    assert(strstr(output, "&lt;script&gt;") != NULL, "expected output to be escaped, got \"%s\"", output);
+    free(output);
+    free(expected);
+    hashmap_free(vars);
+    env_free(env);
+}
+
+END_TESTS
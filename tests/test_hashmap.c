@@ -1,5 +1,6 @@
 #include "test.h"
 #include "hashmap.h"
+#include "stats.h"
 
 START_TESTS
 
@@ -50,4 +51,62 @@ TEST(hashmap_remove) {
     hashmap_free(hm);
 } 
 
+TEST(hashmap_grow) {
+    static char keys[1000][8];
+    struct hashmap *hm = hashmap_new();
+    for (int i=0; i < 1000; i++) {
+        sprintf(keys[i], "k%d", i);
+        char *value = hashmap_insert(hm, keys[i], keys[i]);
+        assert_null(value);
+    }
+    assert(hm->size == 1000, "expected 1000 entries");
+
+    // remove every other key, the remaining keys should still be found
+    for (int i=0; i < 1000; i += 2) {
+        char *value = hashmap_remove(hm, keys[i]);
+        assert_str(value, keys[i]);
+    }
+    for (int i=0; i < 1000; i++) {
+        char *value = hashmap_get(hm, keys[i]);
+        if (i % 2 == 0) {
+            assert_null(value);
+        } else {
+            assert_str(value, keys[i]);
+        }
+    }
+    assert(hm->size == 500, "expected 500 entries");
+    hashmap_free(hm);
+}
+
+TEST(hashmap_insert_all) {
+    char *keys[] = {"foo", "bar", "baz"};
+    void *values[] = {"1", "2", "3"};
+    struct hashmap *hm = hashmap_new_with_cap(2);
+    hashmap_insert_all(hm, keys, values, 3);
+    char *value = hashmap_get(hm, "foo");
+    assert_str(value, "1");
+    value = hashmap_get(hm, "bar");
+    assert_str(value, "2");
+    value = hashmap_get(hm, "baz");
+    assert_str(value, "3");
+    hashmap_free(hm);
+
+    /* many entries at once are rehashed into a table of the final size only */
+    static char many[1000][8];
+    char *many_keys[1000];
+    void *many_values[1000];
+    for (int i=0; i < 1000; i++) {
+        sprintf(many[i], "k%d", i);
+        many_keys[i] = many[i];
+        many_values[i] = many[i];
+    }
+    hm = hashmap_new();
+    size_t allocations = alloc_counter.allocations;
+    hashmap_insert_all(hm, many_keys, many_values, 1000);
+    assert(alloc_counter.allocations - allocations == 1, "expected a single allocation, got %zu", alloc_counter.allocations - allocations);
+    value = hashmap_get(hm, "k999");
+    assert_str(value, "k999");
+    hashmap_free(hm);
+}
+
 END_TESTS
\ No newline at end of file
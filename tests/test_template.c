@@ -1,5 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
 #include "test.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "template.h"
+#include "parser.h"
+#include "object.h"
+
+struct collected {
+    char *string;
+    size_t size;
+    int chunks;
+};
+
+char *join_iov(struct iov_output *out) {
+    size_t size = 0;
+    for (int i=0; i < out->iovcnt; i++) {
+        size += out->iov[i].iov_len;
+    }
+
+    char *str = malloc(size + 1);
+    size = 0;
+    for (int i=0; i < out->iovcnt; i++) {
+        memcpy(str + size, out->iov[i].iov_base, out->iov[i].iov_len);
+        size += out->iov[i].iov_len;
+    }
+    str[size] = '\0';
+    return str;
+}
+
+int collect(const char *buf, size_t len, void *data) {
+    struct collected *c = data;
+    c->string = realloc(c->string, c->size + len + 1);
+    memcpy(c->string + c->size, buf, len);
+    c->size += len;
+    c->string[c->size] = '\0';
+    c->chunks++;
+    return 0;
+}
+
+/* write a file with the given contents, used for testing reloads */
+void write_template(char *dir, char *name, char *contents) {
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    fputs(contents, f);
+    fclose(f);
+}
+
+/* contents of a file written to by the test, which is closed */
+char *read_stream(FILE *f) {
+    long size = ftell(f);
+    char *str = malloc(size + 1);
+    rewind(f);
+    str[fread(str, 1, size, f)] = '\0';
+    fclose(f);
+    return str;
+}
+
+/* iterator counting up to a limit, formatting each number into one of two buffers as an item has to outlive the next call */
+struct counter {
+    int n;
+    int limit;
+    char buf[2][16];
+};
+
+void *count_next(void *state) {
+    struct counter *c = state;
+    if (c->n == c->limit) {
+        return NULL;
+    }
+
+    char *item = c->buf[c->n % 2];
+    sprintf(item, "#%d", c->n++);
+    return item;
+}
+
+/* filter repeating a string as many times as its argument says */
+void filter_repeat(struct arena *arena, struct unja_object *obj, struct unja_object *args, int nargs) {
+    object_to_string(arena, obj);
+    int n = nargs > 0 ? object_to_int(&args[0]) : 1;
+    struct unja_object once = *obj;
+    *obj = make_string_view("", 0);
+    for (int i=0; i < n; i++) {
+        *obj = concat_objects(arena, obj, &once);
+    }
+}
 
 START_TESTS 
 
@@ -206,6 +292,92 @@ TEST(for_block_whitespace) {
     free(output);
 }
 
+TEST(for_block_restores_vars) {
+    char *input = "{% for n in names %}{{ n }}{% endfor %} {{ n }}";
+    struct hashmap *ctx = hashmap_new();
+
+    struct vector *names = vector_new(2);
+    vector_push(names, "John");
+    vector_push(names, "Sally");
+    hashmap_insert(ctx, "names", names);
+    hashmap_insert(ctx, "n", "Eric");
+
+    char *output = template_string(input, ctx);
+    assert_str(output, "JohnSally Eric");
+    assert_null(hashmap_get(ctx, "loop"));
+    vector_free(names);
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(for_block_nested_same_name) {
+    char *input = "{% for n in outer %}{{ n }}{{ loop.index }}"
+                  "({% for n in inner %}{{ n }}{{ loop.index }}{% endfor %})"
+                  "{{ n }}{{ loop.index }}{% endfor %}";
+    struct hashmap *ctx = hashmap_new();
+
+    struct vector *outer = vector_new(2);
+    vector_push(outer, "a");
+    vector_push(outer, "b");
+    hashmap_insert(ctx, "outer", outer);
+    struct vector *inner = vector_new(2);
+    vector_push(inner, "x");
+    vector_push(inner, "y");
+    hashmap_insert(ctx, "inner", inner);
+
+    char *output = template_string(input, ctx);
+    assert_str(output, "a0(x0y1)a0b1(x0y1)b1");
+    vector_free(outer);
+    vector_free(inner);
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(for_range) {
+    char *input = "{% for i in range(n + 1) %}{{ i }}{% if not loop.last %},{% endif %}{% endfor %}|"
+                  "{% for i in range(0) %}empty{% endfor %}|"
+                  "{% for i in range(2) %}{% for j in range(2) %}{{ i }}{{ j }} {% endfor %}{% endfor %}{{ i }}|"
+                  "{% for x in range %}{{ x }}{% endfor %}";
+    struct hashmap *ctx = hashmap_new();
+    struct vector *range = vector_new(1);
+    vector_push(range, "variable");
+    hashmap_insert(ctx, "n", "3");
+    hashmap_insert(ctx, "range", range);
+
+    char *output = template_string(input, ctx);
+    assert_str(output, "0,1,2,3||00 01 10 11 |variable");
+    vector_free(range);
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(for_iterator) {
+    char *input = "{% for row in rows %}{{ row }}{% if loop.last %}.{% else %}, {% endif %}{% endfor %}"
+                  "{% for row in none %}empty{% endfor %}";
+    struct hashmap *ctx = hashmap_new();
+    struct counter rows = { 0, 4 };
+    struct counter none = { 0, 0 };
+    struct unja_value *rows_iter = unja_value_iter(count_next, &rows);
+    struct unja_value *none_iter = unja_value_iter(count_next, &none);
+    hashmap_insert_value(ctx, "rows", rows_iter);
+    hashmap_insert_value(ctx, "none", none_iter);
+
+    char *output = template_string(input, ctx);
+    assert_str(output, "#0, #1, #2, #3.");
+    assert(rows.n == 4, "expected iterator to be exhausted, got %d items", rows.n);
+    unja_value_free(rows_iter);
+    unja_value_free(none_iter);
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(block_without_parent) {
+    char *input = "{% block title %}Default title{% endblock %}";
+    char *output = template_string(input, NULL);
+    assert_str(output, "Default title");
+    free(output);
+}
+
 TEST(var_dot_notation) {
     char *input = "Hello {{user.name}}!";
     struct hashmap *ctx = hashmap_new();
@@ -219,6 +391,104 @@ TEST(var_dot_notation) {
     free(output);
 }
 
+TEST(var_dot_notation_long_key) {
+    char *key = "a_rather_long_variable_name_that_does_not_fit_in_sixty_four_bytes";
+    char *input = "{{ a_rather_long_variable_name_that_does_not_fit_in_sixty_four_bytes.name }}";
+    struct hashmap *ctx = hashmap_new();
+    struct hashmap *user = hashmap_new();
+    hashmap_insert(user, "name", "Danny");
+    hashmap_insert(ctx, key, user);
+    char *output = template_string(input, ctx);
+    assert_str(output, "Danny");
+    hashmap_free(user);
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(typed_values) {
+    char *input = "{{ count + 1 }} {{ count > 9 }} {{ price * 2 }} {{ price > 9 }} {{ total }} "
+                  "{% if flag %}yes{% endif %}{% if not off %}no{% endif %} {{ name }} {{ name | length }} {{ count | length }}";
+    struct hashmap *ctx = hashmap_new();
+    struct unja_value *values[] = {
+        unja_value_int(10),
+        unja_value_float(9.95),
+        unja_value_float(20),
+        unja_value_bool(1),
+        unja_value_bool(0),
+        unja_value_str_n("Danny van Kooten", 5),
+    };
+    hashmap_insert_value(ctx, "count", values[0]);
+    hashmap_insert_value(ctx, "price", values[1]);
+    hashmap_insert_value(ctx, "total", values[2]);
+    hashmap_insert_value(ctx, "flag", values[3]);
+    hashmap_insert_value(ctx, "off", values[4]);
+    hashmap_insert_value(ctx, "name", values[5]);
+
+    char *output = template_string(input, ctx);
+    assert_str(output, "11 1 19.9 1 20.0 yesno Danny 5 2");
+    for (int i=0; i < 6; i++) {
+        unja_value_free(values[i]);
+    }
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(typed_lists_and_maps) {
+    char *input = "{% for n in numbers %}{{ n * loop.index }},{% endfor %} {{ numbers | length }} "
+                  "{% if empty %}full{% else %}empty{% endif %} {{ user.age + 1 }} {% for x in user %}{{ x }}{% endfor %}";
+    struct hashmap *ctx = hashmap_new();
+    struct vector *numbers = vector_new(3);
+    struct unja_value *items[] = { unja_value_int(1), unja_value_int(2), unja_value_int(3) };
+    for (int i=0; i < 3; i++) {
+        vector_push_value(numbers, items[i]);
+    }
+    struct vector *none = vector_new(1);
+    struct hashmap *user = hashmap_new();
+    struct unja_value *age = unja_value_int(36);
+    hashmap_insert_value(user, "age", age);
+
+    struct unja_value *list = unja_value_list(numbers);
+    struct unja_value *empty = unja_value_list(none);
+    struct unja_value *map = unja_value_map(user);
+    hashmap_insert_value(ctx, "numbers", list);
+    hashmap_insert_value(ctx, "empty", empty);
+    hashmap_insert_value(ctx, "user", map);
+
+    char *output = template_string(input, ctx);
+    assert_str(output, "0,2,6, 3 empty 37 ");
+    for (int i=0; i < 3; i++) {
+        unja_value_free(items[i]);
+    }
+    unja_value_free(age);
+    unja_value_free(list);
+    unja_value_free(empty);
+    unja_value_free(map);
+    vector_free(numbers);
+    vector_free(none);
+    hashmap_free(user);
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(strings_are_not_typed_values) {
+    /* a plain string is never read as a typed value, whatever byte it starts with */
+    char *input = "{{ name }} {{ name | length }} {% for x in list %}{{ x }}{% endfor %}";
+    struct hashmap *ctx = hashmap_new();
+    struct vector *list = vector_new(2);
+    struct unja_value *count = unja_value_int(1);
+    vector_push(list, "\xff\xfe");
+    vector_push_value(list, count);
+    hashmap_insert(ctx, "name", "\xff!");
+    hashmap_insert(ctx, "list", list);
+
+    char *output = template_string(input, ctx);
+    assert_str(output, "\xff! 2 \xff\xfe" "1");
+    unja_value_free(count);
+    vector_free(list);
+    hashmap_free(ctx);
+    free(output);
+}
+
 TEST(comment) {
     char *input = "Hello {# comment here #}world.";
     char *output = template_string(input, NULL);
@@ -424,6 +694,53 @@ TEST(if_else_block_whitespace) {
     free(output);
 }
 
+TEST(text_with_braces) {
+    char *input = "function() { return 100%; } {{ 5 }}";
+    char *output = template_string(input, NULL);
+    assert_str(output, "function() { return 100%; } 5");
+    free(output);
+
+    /* text is scanned in vectors, so tags and braces have to be found at every position */
+    char text[128];
+    char expected[128];
+    for (int i=0; i < 40; i++) {
+        snprintf(text, sizeof text, "%.*s{ {{ 5 }}}%.*s{", i, "........................................", 40 - i, "........................................");
+        snprintf(expected, sizeof expected, "%.*s{ 5}%.*s{", i, "........................................", 40 - i, "........................................");
+        output = template_string(text, NULL);
+        assert_str(output, expected);
+        free(output);
+    }
+}
+
+TEST(parse_error) {
+    struct {
+        char *input;
+        int line;
+        int col;
+    } tests[] = {
+        {"Hello\n{{ name", 2, 8},
+        {"{% for n in names %}\n\t{{ n }}", 2, 9},
+        {"{% if 5 > %}1{% endif %}", 1, 11},
+        {"{% foo %}", 1, 4},
+        {"{{ \"unterminated }}", 1, 4},
+        {"{% endif %}", 1, 1},
+        {"{% for i in range(3 %}{% endfor %}", 1, 21},
+        {"{{ s | truncate(5 }}", 1, 19},
+        {"{{ s | }}", 1, 8},
+        {"{% block a %}X{% block a %}{% endblock %}{% endblock %}", 1, 24},
+        {"{% block a %}{% endblock %}\n{% block a %}{% endblock %}", 2, 10},
+        {"<style>\n.a { color: red; }\n</style>\n\n<p>Lorem ipsum dolor sit amet, {consectetur} {{ adipiscing +", 5, 61},
+        {"<p>\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n</p>{{ ", 19, 8},
+    };
+
+    for (int i=0; i < ARRAY_SIZE(tests); i++) {
+        struct parse_error error;
+        struct ast *ast = parse(tests[i].input, &error);
+        assert(ast == NULL, "expected parse error for \"%s\"", tests[i].input);
+        assert(error.line == tests[i].line && error.col == tests[i].col, "expected error at %d:%d, got %d:%d (%s)", tests[i].line, tests[i].col, error.line, error.col, error.message);
+    }
+}
+
 TEST(buffer_alloc) {
     /* Output a string so that output buffer is longer than template buffer, 
         to test dynamic allocation */
@@ -454,6 +771,421 @@ TEST(inheritance_depth_2) {
     env_free(env);
 }
 
+TEST(inheritance_nested_blocks) {
+    struct env *env = env_new("./tests/data/inheritance-nested/");
+    struct hashmap *ctx = hashmap_new();
+    struct vector *items = vector_new(2);
+    vector_push(items, "a");
+    vector_push(items, "b");
+    hashmap_insert(ctx, "items", items);
+
+    char *output = template(env, "two.tmpl", ctx);
+    assert_str(output, "<(two)(two)>");
+    free(output);
+    output = template(env, "one.tmpl", ctx);
+    assert_str(output, "<(one)(one)>");
+    free(output);
+    output = template(env, "base.tmpl", ctx);
+    assert_str(output, "<[base]>");
+    free(output);
+
+    /* blocks see the loop variables of where they are inlined, not of where they are defined */
+    hashmap_insert(ctx, "i", "user");
+    output = template(env, "three.tmpl", ctx);
+    assert_str(output, "<(0a)(1b)>");
+    free(output);
+    output = template(env, "four.tmpl", ctx);
+    assert_str(output, "<[user]>");
+    free(output);
+
+    vector_free(items);
+    hashmap_free(ctx);
+    env_free(env);
+}
+
+TEST(env_recursive) {
+    struct env_options options = {
+        .threads = 4,
+        .recursive = 1,
+    };
+    struct env *env = env_new_with_options("./tests/data/recursive", &options);
+    char *output = template(env, "emails/welcome.tmpl", NULL);
+    assert_str(output, "Hello world!");
+    free(output);
+    output = template(env, "base.tmpl", NULL);
+    assert_str(output, "Hello nobody!");
+    free(output);
+    env_free(env);
+}
+
+TEST(env_lazy) {
+    struct env_options options = {
+        .threads = 1,
+        .recursive = 1,
+        .lazy = 1,
+        .cache_size = 1,
+    };
+    struct env *env = env_new_with_options("./tests/data/inheritance-depth-2", &options);
+
+    /* hold on to the program of one.tmpl while the tiny cache keeps evicting everything else */
+    struct iov_output out;
+    template_iov(env, "one.tmpl", NULL, &out);
+    for (int i=0; i < 3; i++) {
+        char *output = template(env, "two.tmpl", NULL);
+        assert_str(output, "0\n1\n2\n");
+        free(output);
+        output = template(env, "base.tmpl", NULL);
+        assert_str(output, "0\n0\n0\n");
+        free(output);
+    }
+
+    char *joined = join_iov(&out);
+    assert_str(joined, "0\n1\n1\n");
+    free(joined);
+    iov_output_free(&out);
+    env_free(env);
+}
+
+TEST(env_lazy_errors) {
+    char *dir = "./bin/cycle";
+    struct env_options options = {
+        .threads = 1,
+        .recursive = 1,
+        .lazy = 1,
+    };
+    mkdir(dir, 0755);
+    write_template(dir, "a.tmpl", "{% extends \"b.tmpl\" %}");
+    write_template(dir, "b.tmpl", "{% extends \"a.tmpl\" %}");
+    write_template(dir, "c.tmpl", "{% extends \"missing.tmpl\" %}");
+    write_template(dir, "ok.tmpl", "ok");
+    write_template(dir, "broken.tmpl", "{% if %}");
+    write_template(dir, "d.tmpl", "{% extends \"broken.tmpl\" %}");
+    struct env *env = env_new_with_options(dir, &options);
+
+    /* templates that can not be linked fail on their own, without taking the env down with them */
+    for (int i=0; i < 2; i++) {
+        char *output = template(env, "a.tmpl", NULL);
+        assert(output == NULL, "expected cyclic template to fail");
+        output = template(env, "c.tmpl", NULL);
+        assert(output == NULL, "expected template with missing parent to fail");
+        output = template(env, "broken.tmpl", NULL);
+        assert(output == NULL, "expected template with syntax error to fail");
+        output = template(env, "d.tmpl", NULL);
+        assert(output == NULL, "expected template extending one with a syntax error to fail");
+        output = template(env, "ok.tmpl", NULL);
+        assert_str(output, "ok");
+        free(output);
+    }
+
+    env_free(env);
+    remove("./bin/cycle/a.tmpl");
+    remove("./bin/cycle/b.tmpl");
+    remove("./bin/cycle/c.tmpl");
+    remove("./bin/cycle/ok.tmpl");
+    remove("./bin/cycle/broken.tmpl");
+    remove("./bin/cycle/d.tmpl");
+    rmdir(dir);
+}
+
+TEST(env_reload) {
+    char *dir = "./bin/reload";
+    mkdir(dir, 0755);
+    write_template(dir, "base.tmpl", "A{% block x %}a{% endblock %}");
+    write_template(dir, "child.tmpl", "{% extends \"base.tmpl\" %}{% block x %}c{% endblock %}");
+    write_template(dir, "other.tmpl", "other");
+    struct env *env = env_new(dir);
+    char *output = template(env, "child.tmpl", NULL);
+    assert_str(output, "Ac");
+    free(output);
+
+    /* changing the parent recompiles the child as well */
+    write_template(dir, "base.tmpl", "B{% block x %}b{% endblock %}");
+    char *changed[] = { "base.tmpl" };
+    int count = env_reload(env, changed, 1);
+    assert(count == 2, "expected 2 templates to be reloaded, got %d", count);
+    output = template(env, "child.tmpl", NULL);
+    assert_str(output, "Bc");
+    free(output);
+
+    /* a template that fails to compile keeps its previous version */
+    write_template(dir, "other.tmpl", "{% if %}");
+    char *broken[] = { "other.tmpl" };
+    count = env_reload(env, broken, 1);
+    assert(count == 0, "expected no templates to be reloaded, got %d", count);
+    output = template(env, "other.tmpl", NULL);
+    assert_str(output, "other");
+    free(output);
+
+    /* new templates are added, removed ones are dropped */
+    write_template(dir, "new.tmpl", "{% extends \"base.tmpl\" %}");
+    remove("./bin/reload/other.tmpl");
+    char *added[] = { "new.tmpl", "other.tmpl" };
+    count = env_reload(env, added, 2);
+    assert(count == 1, "expected 1 template to be reloaded, got %d", count);
+    output = template(env, "new.tmpl", NULL);
+    assert_str(output, "Bb");
+    free(output);
+
+    /* so does a template that defines a block twice, or whose blocks nest too deeply once linked */
+    write_template(dir, "child.tmpl", "{% extends \"base.tmpl\" %}{% block x %}X{% block x %}c{% endblock %}{% endblock %}");
+    char *child[] = { "child.tmpl" };
+    count = env_reload(env, child, 1);
+    assert(count == 0, "expected no templates to be reloaded, got %d", count);
+    output = template(env, "child.tmpl", NULL);
+    assert_str(output, "Bc");
+    free(output);
+
+    char nested[4096] = "{% extends \"base.tmpl\" %}{% block x %}";
+    for (int i=0; i < 70; i++) {
+        sprintf(nested + strlen(nested), "{%% block b%d %%}", i);
+    }
+    for (int i=0; i < 70; i++) {
+        strcat(nested, "{% endblock %}");
+    }
+    strcat(nested, "{% endblock %}");
+    write_template(dir, "child.tmpl", nested);
+    count = env_reload(env, child, 1);
+    assert(count == 0, "expected no templates to be reloaded, got %d", count);
+    output = template(env, "child.tmpl", NULL);
+    assert_str(output, "Bc");
+    free(output);
+    write_template(dir, "child.tmpl", "{% extends \"base.tmpl\" %}{% block x %}c{% endblock %}");
+
+    /* a directory stands for all templates below it, an empty name for all templates */
+    mkdir("./bin/reload/sub", 0755);
+    write_template(dir, "sub/a.tmpl", "a");
+    char *sub[] = { "sub/a.tmpl" };
+    count = env_reload(env, sub, 1);
+    assert(count == 1, "expected 1 template to be reloaded, got %d", count);
+    char *all[] = { "" };
+    count = env_reload(env, all, 1);
+    assert(count == 4, "expected 4 templates to be reloaded, got %d", count);
+    remove("./bin/reload/sub/a.tmpl");
+    rmdir("./bin/reload/sub");
+    char *removed[] = { "sub/" };
+    count = env_reload(env, removed, 1);
+    struct env_stats stats;
+    env_stats(env, &stats);
+    assert(stats.templates == 3, "expected 3 templates, got %d", stats.templates);
+
+    /* a chain that extends itself keeps the previous versions */
+    write_template(dir, "base.tmpl", "{% extends \"child.tmpl\" %}");
+    count = env_reload(env, changed, 1);
+    output = template(env, "base.tmpl", NULL);
+    assert_str(output, "Bb");
+    free(output);
+    output = template(env, "child.tmpl", NULL);
+    assert_str(output, "Bc");
+    free(output);
+
+    /* and so do templates whose parent was removed */
+    remove("./bin/reload/base.tmpl");
+    count = env_reload(env, changed, 1);
+    assert(count == 0, "expected no templates to be reloaded, got %d", count);
+    output = template(env, "new.tmpl", NULL);
+    assert_str(output, "Bb");
+    free(output);
+
+    env_free(env);
+    remove("./bin/reload/base.tmpl");
+    remove("./bin/reload/child.tmpl");
+    remove("./bin/reload/new.tmpl");
+    rmdir(dir);
+}
+
+TEST(env_cache_file) {
+    char *dir = "./bin/cached";
+    char *cache = "./bin/cached.cache";
+    struct env_options options = {
+        .threads = 1,
+        .recursive = 1,
+        .cache_file = cache,
+    };
+    mkdir(dir, 0755);
+    remove(cache);
+    write_template(dir, "base.tmpl", "A{% block x %}a{% endblock %}");
+    write_template(dir, "child.tmpl", "{% extends \"base.tmpl\" %}{% block x %}{% for i in items %}{{ i.name }}{% endfor %}{% endblock %}");
+    struct hashmap *vars = hashmap_new();
+    struct hashmap *item = hashmap_new();
+    struct vector *items = vector_new(1);
+    hashmap_insert(item, "name", "c");
+    vector_push(items, item);
+    hashmap_insert(vars, "items", items);
+
+    /* first load writes the cache, the second one uses it */
+    for (int i=0; i < 2; i++) {
+        struct env *env = env_new_with_options(dir, &options);
+        struct stat st;
+        assert(stat(cache, &st) == 0, "expected cache file to be written");
+        char *output = template(env, "child.tmpl", vars);
+        assert_str(output, "Ac");
+        free(output);
+        env_free(env);
+    }
+
+    /* changed templates are compiled again */
+    write_template(dir, "base.tmpl", "BB{% block x %}a{% endblock %}");
+    struct env *env = env_new_with_options(dir, &options);
+    char *output = template(env, "child.tmpl", vars);
+    assert_str(output, "BBc");
+    free(output);
+    env_free(env);
+
+    /* including changes within the same second that keep the size */
+    struct timespec times[2] = { { 1000000, 1 }, { 1000000, 1 } };
+    utimensat(AT_FDCWD, "./bin/cached/base.tmpl", times, 0);
+    env_free(env_new_with_options(dir, &options));
+    write_template(dir, "base.tmpl", "CC{% block x %}a{% endblock %}");
+    times[0].tv_nsec = times[1].tv_nsec = 2;
+    utimensat(AT_FDCWD, "./bin/cached/base.tmpl", times, 0);
+    env = env_new_with_options(dir, &options);
+    output = template(env, "child.tmpl", vars);
+    assert_str(output, "CCc");
+    free(output);
+    env_free(env);
+
+    /* a corrupt cache file is ignored */
+    FILE *f = fopen(cache, "r+");
+    fseek(f, 100, SEEK_SET);
+    fputs("garbage", f);
+    fclose(f);
+    env = env_new_with_options(dir, &options);
+    output = template(env, "base.tmpl", vars);
+    assert_str(output, "CCa");
+    free(output);
+    env_free(env);
+
+    vector_free(items);
+    hashmap_free(item);
+    hashmap_free(vars);
+    remove(cache);
+    remove("./bin/cached/base.tmpl");
+    remove("./bin/cached/child.tmpl");
+    rmdir(dir);
+}
+
+TEST(template_with_stats) {
+    struct env *env = env_new("./tests/data/streaming/");
+    struct hashmap *ctx = hashmap_new();
+    struct vector *items = vector_new(100);
+    hashmap_insert(ctx, "items", items);
+
+    struct render_stats empty;
+    free(template_with_stats(env, "list.tmpl", ctx, &empty));
+    for (int i=0; i < 100; i++) {
+        vector_push(items, "item");
+    }
+
+    struct render_stats stats;
+    char *output = template_with_stats(env, "list.tmpl", ctx, &stats);
+    char *expected = template(env, "list.tmpl", ctx);
+    assert_str(output, expected);
+    assert(stats.instructions > 100 * 3, "expected instructions of every iteration to be counted, got %zu", stats.instructions);
+    assert(stats.hashmap_probes > 0, "expected a probe for the lookup of items");
+    assert(stats.hashmap_probes < 100, "expected loop variable item to be read from its slot, got %zu probes", stats.hashmap_probes);
+    assert(stats.peak_buffer_size > strlen(output), "expected buffer of at least %zu bytes, got %zu", strlen(output), stats.peak_buffer_size);
+    assert(stats.buffer_reallocs > 0, "expected output buffer to grow");
+    assert(stats.allocations > stats.buffer_reallocs, "expected allocations to include the buffer, got %zu", stats.allocations);
+    assert(stats.allocations - stats.buffer_reallocs <= empty.allocations, "expected loop to take its state from the arena, got %zu allocations", stats.allocations);
+    assert(stats.bytes_allocated >= stats.peak_buffer_size, "expected at least %zu bytes allocated, got %zu", stats.peak_buffer_size, stats.bytes_allocated);
+    free(output);
+    free(expected);
+
+    vector_free(items);
+    hashmap_free(ctx);
+    env_free(env);
+}
+
+TEST(env_stats) {
+    struct env *env = env_new("./tests/data/inheritance-depth-2/");
+    struct env_stats stats;
+    env_stats(env, &stats);
+    assert(stats.templates == 3, "expected 3 templates, got %d", stats.templates);
+    assert(stats.compiled == 3, "expected 3 compiled templates, got %d", stats.compiled);
+    assert(stats.name_bytes == strlen("base.tmpl one.tmpl two.tmpl") + 1, "expected names to take 30 bytes, got %zu", stats.name_bytes);
+    assert(stats.program_bytes > 0 && stats.block_bytes > 0 && stats.index_bytes > 0, "expected memory of programs, blocks and index to be reported");
+    assert(stats.mapped_bytes == 0, "expected no mapped programs, got %zu bytes", stats.mapped_bytes);
+    env_free(env);
+
+    struct env_options options = {
+        .lazy = 1,
+    };
+    env = env_new_with_options("./tests/data/inheritance-depth-2/", &options);
+    env_stats(env, &stats);
+    assert(stats.compiled == 0 && stats.program_bytes == 0, "expected lazy env not to compile templates up front");
+    free(template(env, "one.tmpl", NULL));
+    env_stats(env, &stats);
+    assert(stats.compiled == 2, "expected template and its parent to be compiled, got %d", stats.compiled);
+    env_free(env);
+}
+
+TEST(template_profile) {
+    struct env *env = env_new("./tests/data/profile/");
+    struct hashmap *ctx = hashmap_new();
+    struct vector *items = vector_new(10);
+    for (int i=0; i < 10; i++) {
+        vector_push(items, "ITEM");
+    }
+    hashmap_insert(ctx, "items", items);
+
+    struct profile *profile = profile_new();
+    char *expected = template(env, "page.tmpl", ctx);
+    for (int i=0; i < 3; i++) {
+        char *output = template_profile(env, "page.tmpl", ctx, profile);
+        assert_str(output, expected);
+        free(output);
+    }
+
+    FILE *f = tmpfile();
+    profile_report(profile, f);
+    char *report = read_stream(f);
+    assert(strstr(report, "3 renders") != NULL, "expected renders to be counted, got\n%s", report);
+    assert(strstr(report, "3  page.tmpl\n") != NULL, "expected template to have run 3 times, got\n%s", report);
+    assert(strstr(report, "3  base.tmpl:2 block content\n") != NULL, "expected block to be mapped to its parent, got\n%s", report);
+    assert(strstr(report, "3  page.tmpl:3 for item\n") != NULL, "expected loop to have run 3 times, got\n%s", report);
+    assert(strstr(report, "30  page.tmpl:4\n") != NULL, "expected loop body to have run 30 times, got\n%s", report);
+    assert(strstr(report, "base.tmpl:3") == NULL, "expected overridden block not to be reported, got\n%s", report);
+
+    f = tmpfile();
+    profile_write_folded(profile, f);
+    char *folded = read_stream(f);
+    assert(strstr(folded, "\npage.tmpl;base.tmpl:2 block content;page.tmpl:3 for item;page.tmpl:4 ") != NULL, "expected stack of loop body, got\n%s", folded);
+    assert(strstr(folded, "page.tmpl;base.tmpl:1 ") == folded, "expected stacks in order, got\n%s", folded);
+
+    free(report);
+    free(folded);
+    free(expected);
+    profile_free(profile);
+    vector_free(items);
+    hashmap_free(ctx);
+    env_free(env);
+}
+
+TEST(read_file_large) {
+    /* large enough to take several reads with a stdio sized buffer */
+    size_t size = 100000;
+    char *text = malloc(size + 1);
+    for (size_t i=0; i < size; i++) {
+        text[i] = 'a' + i % 26;
+    }
+    text[size] = '\0';
+    mkdir("./bin/large", 0755);
+    write_template("./bin/large", "large.tmpl", text);
+
+    char *contents = read_file("./bin/large/large.tmpl");
+    assert(strcmp(contents, text) == 0, "expected file contents to be read in full, got %zu bytes", strlen(contents));
+    struct env *env = env_new("./bin/large");
+    char *output = template(env, "large.tmpl", NULL);
+    assert(strcmp(output, text) == 0, "expected large template to render in full");
+    free(output);
+    env_free(env);
+
+    free(contents);
+    free(text);
+    remove("./bin/large/large.tmpl");
+    rmdir("./bin/large");
+}
+
 TEST(filter_trim) {
     char *input = "{{ text | trim }}";
     struct hashmap *ctx = hashmap_new();
@@ -465,6 +1197,121 @@ TEST(filter_trim) {
     free(output);
 }
 
+TEST(filter_does_not_modify_vars) {
+    char *input = "{{ text | trim }}|{{ text | lower }}|{{ text }}";
+    struct hashmap *ctx = hashmap_new();
+    char text[] = " Hello World ";
+    hashmap_insert(ctx, "text", text);
+    char *output = template_string(input, ctx);
+    assert_str(output, "Hello World| hello world | Hello World ");
+    assert_str(text, " Hello World ");
+    hashmap_free(ctx);
+    free(output);
+}
+
+TEST(filter_escape) {
+    struct hashmap *ctx = hashmap_new();
+    char input[41];
+    char expected[128];
+
+    /* a character to escape at every position, across the vectors the text is scanned in */
+    for (int i=0; i < 40; i++) {
+        memset(input, 'x', 40);
+        input[40] = '\0';
+        input[i] = '<';
+        hashmap_insert(ctx, "s", input);
+        sprintf(expected, "%.*s&lt;%s", i, input, input + i + 1);
+        char *output = template_string("{{ s | e }}", ctx);
+        assert_str(output, expected);
+        free(output);
+    }
+
+    hashmap_insert(ctx, "s", "<a href=\"x\">'&'</a>");
+    char *output = template_string("{{ s | escape }}|{{ s | safe }}", ctx);
+    assert_str(output, "&lt;a href=&#34;x&#34;&gt;&#39;&amp;&#39;&lt;/a&gt;|<a href=\"x\">'&'</a>");
+    free(output);
+    hashmap_free(ctx);
+}
+
+TEST(autoescape) {
+    struct env_options options = {
+        .recursive = 1,
+        .autoescape = 1,
+    };
+    struct env *env = env_new_with_options("./tests/data/autoescape/", &options);
+    struct env *plain = env_new("./tests/data/autoescape/");
+    struct hashmap *ctx = hashmap_new();
+    struct unja_value *count = unja_value_int(3);
+    hashmap_insert(ctx, "title", "\"quoted\" & 'single'");
+    hashmap_insert(ctx, "body", "<script>alert(1)</script>");
+    hashmap_insert(ctx, "html", "<b>bold</b>");
+    hashmap_insert_value(ctx, "count", count);
+
+    char *escaped = "<p title=\"&#34;quoted&#34; &amp; &#39;single&#39;\">&lt;script&gt;alert(1)&lt;/script&gt;</p>\n"
+                    "<b>bold</b>\n"
+                    "&lt;script&gt;alert(1)&lt;/script&gt;\n"
+                    "3\n";
+    char *output = template(env, "page.tmpl", ctx);
+    assert_str(output, escaped);
+    free(output);
+
+    struct iov_output out;
+    template_iov(env, "page.tmpl", ctx, &out);
+    output = join_iov(&out);
+    assert_str(output, escaped);
+    free(output);
+    iov_output_free(&out);
+
+    output = template(plain, "page.tmpl", ctx);
+    assert_str(output, "<p title=\"\"quoted\" & 'single'\"><script>alert(1)</script></p>\n"
+                       "<b>bold</b>\n"
+                       "&lt;script&gt;alert(1)&lt;/script&gt;\n"
+                       "3\n");
+    free(output);
+
+    unja_value_free(count);
+    hashmap_free(ctx);
+    env_free(plain);
+    env_free(env);
+}
+
+TEST(filter_chain) {
+    struct hashmap *ctx = hashmap_new();
+    hashmap_insert(ctx, "s", "  Hello World  ");
+    char *output = template_string("{{ s | trim | lower }}|{{ s|trim|length }}|{{ s | trim | truncate(8) }}|{{ s | truncate( 2 ) }}|{{ s | truncate }}", ctx);
+    assert_str(output, "hello world|11|Hello...|  |  Hello World  ");
+    free(output);
+    hashmap_free(ctx);
+}
+
+TEST(filter_user) {
+    struct unja_filter filters[] = {
+        { "repeat", filter_repeat },
+    };
+    struct env_options options = {
+        .recursive = 1,
+        .filters = filters,
+        .nfilters = 1,
+    };
+    struct env *env = env_new_with_options("./tests/data/filters/", &options);
+    struct hashmap *ctx = hashmap_new();
+    hashmap_insert(ctx, "name", "Hello");
+
+    char *output = template(env, "page.tmpl", ctx);
+    assert_str(output, "HelloHelloHello|hello...|0\n");
+    free(output);
+
+    /* filters are resolved again when templates are reloaded */
+    char *names[] = { "page.tmpl" };
+    assert(env_reload(env, names, 1) == 1, "expected template to be reloaded");
+    output = template(env, "page.tmpl", ctx);
+    assert_str(output, "HelloHelloHello|hello...|0\n");
+    free(output);
+
+    hashmap_free(ctx);
+    env_free(env);
+}
+
 TEST(filter_lower) {
     char *input = "{{ \"Hello World\" | lower }}";
     char *output = template_string(input, NULL);
@@ -499,4 +1346,63 @@ TEST(inheritance_depth_2) {
     env_free(env);
 }
 
+TEST(template_stream) {
+    struct env *env = env_new("./tests/data/streaming/");
+    struct hashmap *ctx = hashmap_new();
+    struct vector *items = vector_new(2000);
+    for (int i=0; i < 2000; i++) {
+        vector_push(items, "item");
+    }
+    hashmap_insert(ctx, "items", items);
+
+    struct collected c = { NULL, 0, 0 };
+    struct sink sink = { collect, &c };
+    int ret = template_stream(env, "list.tmpl", ctx, sink);
+    assert(ret == 0, "expected 0, got %d", ret);
+    assert(c.chunks > 1, "expected output in multiple chunks, got %d", c.chunks);
+
+    char *output = template(env, "list.tmpl", ctx);
+    assert(strcmp(output, c.string) == 0, "streamed output differs from rendered output");
+    assert(strstr(output, "</li>\n</ul>") != NULL, "expected trailing whitespace to be trimmed");
+
+    FILE *f = tmpfile();
+    ret = template_stream(env, "list.tmpl", ctx, sink_file(f));
+    assert(ret == 0, "expected 0, got %d", ret);
+    assert(ftell(f) == c.size, "expected %ld bytes in file, got %ld", (long) c.size, ftell(f));
+    fclose(f);
+
+    free(c.string);
+    free(output);
+    vector_free(items);
+    hashmap_free(ctx);
+    env_free(env);
+}
+
+TEST(template_iov) {
+    struct env *env = env_new("./tests/data/streaming/");
+    struct hashmap *ctx = hashmap_new();
+    struct vector *items = vector_new(3);
+    vector_push(items, "one");
+    vector_push(items, "two");
+    vector_push(items, "three");
+    hashmap_insert(ctx, "items", items);
+
+    struct iov_output a, b;
+    template_iov(env, "list.tmpl", ctx, &a);
+    template_iov(env, "list.tmpl", ctx, &b);
+    char *output = template(env, "list.tmpl", ctx);
+    char *joined = join_iov(&a);
+    assert_str(joined, output);
+    assert(a.iov[0].iov_base == b.iov[0].iov_base, "expected template text to be referenced instead of copied");
+    assert(a.iov[2].iov_base != b.iov[2].iov_base, "expected variable to be copied to scratch memory");
+
+    free(joined);
+    free(output);
+    iov_output_free(&a);
+    iov_output_free(&b);
+    vector_free(items);
+    hashmap_free(ctx);
+    env_free(env);
+}
+
 END_TESTS 
\ No newline at end of file
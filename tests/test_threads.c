@@ -0,0 +1,238 @@
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "test.h"
+#include "template.h"
+
+#define NUM_THREADS 8
+#define NUM_RENDERS 500
+
+struct job {
+    struct env *env;
+    char *name;
+    struct hashmap *vars;
+    char *expected;
+    int failures;
+
+    /* profile shared by all jobs, or NULL to render without profiling */
+    struct profile *profile;
+};
+
+/* render the same template over and over, counting outputs that differ from the expected one */
+void *render_job(void *arg) {
+    struct job *job = arg;
+    for (int i=0; i < NUM_RENDERS; i++) {
+        char *output = job->profile ? template_profile(job->env, job->name, job->vars, job->profile) : template(job->env, job->name, job->vars);
+        if (output == NULL || strcmp(output, job->expected) != 0) {
+            job->failures++;
+        }
+        free(output);
+    }
+
+    return NULL;
+}
+
+/* render template from NUM_THREADS threads at once, adding to profile if it is not NULL. returns the number of wrong outputs */
+int render_concurrently_profiled(struct env *env, char *name, struct hashmap *vars, struct profile *profile) {
+    pthread_t threads[NUM_THREADS];
+    struct job jobs[NUM_THREADS];
+    char *expected = template(env, name, vars);
+    int failures = 0;
+
+    for (int i=0; i < NUM_THREADS; i++) {
+        jobs[i] = (struct job) { env, name, vars, expected, 0, profile };
+        pthread_create(&threads[i], NULL, render_job, &jobs[i]);
+    }
+    for (int i=0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        failures += jobs[i].failures;
+    }
+
+    free(expected);
+    return failures;
+}
+
+int render_concurrently(struct env *env, char *name, struct hashmap *vars) {
+    return render_concurrently_profiled(env, name, vars, NULL);
+}
+
+struct reload_job {
+    struct env *env;
+    int stop;
+    int failures;
+};
+
+/* keep rendering while templates are being reloaded, every output should be either the old or the new version */
+void *render_while_reloading(void *arg) {
+    struct reload_job *job = arg;
+    while (!__atomic_load_n(&job->stop, __ATOMIC_SEQ_CST)) {
+        char *output = template(job->env, "child.tmpl", NULL);
+        if (strcmp(output, "Ac") != 0 && strcmp(output, "Bc") != 0) {
+            job->failures++;
+        }
+        free(output);
+    }
+
+    return NULL;
+}
+
+void write_template(char *path, char *contents) {
+    FILE *f = fopen(path, "w");
+    fputs(contents, f);
+    fclose(f);
+}
+
+/* wait for the env to hold n templates, returns 0 if it does not within 2 seconds */
+int wait_for_templates(struct env *env, int n) {
+    struct env_stats stats;
+    for (int i=0; i < 200; i++) {
+        env_stats(env, &stats);
+        if (stats.templates == n) {
+            return 1;
+        }
+        struct timespec delay = { 0, 10 * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+    }
+
+    return 0;
+}
+
+START_TESTS
+
+TEST(inheritance) {
+    struct env *env = env_new("./tests/data/inheritance-depth-2/");
+    int failures = render_concurrently(env, "two.tmpl", NULL);
+    assert(failures == 0, "expected no failures, got %d", failures);
+    env_free(env);
+}
+
+TEST(lazy) {
+    struct env_options options = {
+        .threads = 1,
+        .recursive = 1,
+        .lazy = 1,
+        .cache_size = 1,
+    };
+    struct env *env = env_new_with_options("./tests/data/inheritance-depth-2/", &options);
+    int failures = render_concurrently(env, "two.tmpl", NULL);
+    failures += render_concurrently(env, "one.tmpl", NULL);
+    assert(failures == 0, "expected no failures, got %d", failures);
+    env_free(env);
+}
+
+TEST(loops) {
+    struct env *env = env_new("./tests/data/inheritance-nested/");
+    struct hashmap *vars = hashmap_new();
+    struct vector *items = vector_new(3);
+    vector_push(items, "a");
+    vector_push(items, "b");
+    vector_push(items, "c");
+    hashmap_insert(vars, "items", items);
+
+    int failures = render_concurrently(env, "two.tmpl", vars);
+    assert(failures == 0, "expected no failures, got %d", failures);
+    assert(vars->size == 1, "expected vars to be left untouched, got %d entries", (int) vars->size);
+
+    vector_free(items);
+    hashmap_free(vars);
+    env_free(env);
+}
+
+TEST(profile) {
+    struct env *env = env_new("./tests/data/inheritance-nested/");
+    struct hashmap *vars = hashmap_new();
+    struct vector *items = vector_new(1);
+    vector_push(items, "a");
+    hashmap_insert(vars, "items", items);
+
+    struct profile *profile = profile_new();
+    int failures = render_concurrently_profiled(env, "two.tmpl", vars, profile);
+    assert(failures == 0, "expected no failures, got %d", failures);
+
+    char expected[64];
+    sprintf(expected, "%d renders", NUM_THREADS * NUM_RENDERS);
+    FILE *f = tmpfile();
+    profile_report(profile, f);
+    char report[256];
+    rewind(f);
+    report[fread(report, 1, sizeof report - 1, f)] = '\0';
+    fclose(f);
+    assert(strncmp(report, expected, strlen(expected)) == 0, "expected \"%s\", got \"%s\"", expected, report);
+
+    profile_free(profile);
+    vector_free(items);
+    hashmap_free(vars);
+    env_free(env);
+}
+
+TEST(streaming) {
+    struct env *env = env_new("./tests/data/streaming/");
+    struct hashmap *vars = hashmap_new();
+    struct vector *items = vector_new(2000);
+    for (int i=0; i < 2000; i++) {
+        vector_push(items, "item");
+    }
+    hashmap_insert(vars, "items", items);
+
+    int failures = render_concurrently(env, "list.tmpl", vars);
+    assert(failures == 0, "expected no failures, got %d", failures);
+
+    vector_free(items);
+    hashmap_free(vars);
+    env_free(env);
+}
+
+TEST(watch) {
+    mkdir("./bin/watch", 0755);
+    write_template("./bin/watch/base.tmpl", "A{% block x %}a{% endblock %}");
+    write_template("./bin/watch/child.tmpl", "{% extends \"base.tmpl\" %}{% block x %}c{% endblock %}");
+    struct env *env = env_new("./bin/watch");
+    int ret = env_watch(env);
+    assert(ret == 0, "expected watching to succeed");
+
+    pthread_t threads[NUM_THREADS];
+    struct reload_job jobs[NUM_THREADS];
+    for (int i=0; i < NUM_THREADS; i++) {
+        jobs[i] = (struct reload_job) { env, 0, 0 };
+        pthread_create(&threads[i], NULL, render_while_reloading, &jobs[i]);
+    }
+
+    write_template("./bin/watch/base.tmpl", "B{% block x %}b{% endblock %}");
+    char *output = NULL;
+    for (int i=0; i < 200; i++) {
+        free(output);
+        output = template(env, "child.tmpl", NULL);
+        if (strcmp(output, "Bc") == 0) {
+            break;
+        }
+        struct timespec delay = { 0, 10 * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+    }
+    assert_str(output, "Bc");
+    free(output);
+
+    int failures = 0;
+    for (int i=0; i < NUM_THREADS; i++) {
+        __atomic_store_n(&jobs[i].stop, 1, __ATOMIC_SEQ_CST);
+        pthread_join(threads[i], NULL);
+        failures += jobs[i].failures;
+    }
+    assert(failures == 0, "expected no failures, got %d", failures);
+
+    /* templates in a directory that is moved away are dropped, although they do not generate events of their own */
+    mkdir("./bin/watch/sub", 0755);
+    write_template("./bin/watch/sub/a.tmpl", "a");
+    assert(wait_for_templates(env, 3), "expected template in new directory to be added");
+    rename("./bin/watch/sub", "./bin/watch-sub");
+    assert(wait_for_templates(env, 2), "expected templates of moved directory to be dropped");
+    remove("./bin/watch-sub/a.tmpl");
+    rmdir("./bin/watch-sub");
+
+    env_free(env);
+    remove("./bin/watch/base.tmpl");
+    remove("./bin/watch/child.tmpl");
+    rmdir("./bin/watch");
+}
+
+END_TESTS
@@ -0,0 +1,514 @@
+/*
+ * unja-compile translates all templates in a directory to a C source file, ahead of time.
+ *
+ * Inheritance is resolved first, so every template becomes one function of straight-line code with gotos:
+ * static text is passed on as string constants of known length, expressions are evaluated in local variables
+ * and builtin filters are called directly, others are looked up once per render. The generated file defines a single function with the signature
+ * of template(), which renders the compiled templates and passes other names on to the env it is given.
+ * With -e, the compiled templates escape their output for HTML like an env with autoescape set.
+ *
+ * usage: unja-compile [-e] [-n function] [-o file.c] directory
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "template.h"
+#include "program.h"
+#include "object.h"
+#include "compiled.h"
+
+/* what is known about a value on the stack at compile time */
+enum value_type {
+    VALUE_ANY,
+    VALUE_INT,
+    VALUE_STRING,
+};
+
+struct unit {
+    FILE *out;
+    char **names;
+    struct program **programs;
+    int size;
+    int cap;
+};
+
+/* filters that are called directly, by their name in templates */
+static const struct {
+    const char *name;
+    const char *function;
+} builtin_filters[] = {
+    { "trim", "filter_trim" },
+    { "lower", "filter_lower" },
+    { "wordcount", "filter_wordcount" },
+    { "length", "filter_length" },
+    { "escape", "filter_escape" },
+    { "e", "filter_escape" },
+    { "safe", "filter_safe" },
+    { "truncate", "filter_truncate" },
+};
+
+static const char *binary_operators[] = {
+    [OP_ADD] = "+",
+    [OP_SUB] = "-",
+    [OP_MUL] = "*",
+    [OP_DIV] = "/",
+    [OP_MOD] = "%",
+    [OP_GT] = ">",
+    [OP_GTE] = ">=",
+    [OP_LT] = "<",
+    [OP_LTE] = "<=",
+    [OP_EQ] = "==",
+    [OP_NEQ] = "!=",
+};
+
+static const char *opcode_names[] = {
+    [OP_ADD] = "OP_ADD",
+    [OP_SUB] = "OP_SUB",
+    [OP_MUL] = "OP_MUL",
+    [OP_DIV] = "OP_DIV",
+    [OP_MOD] = "OP_MOD",
+    [OP_GT] = "OP_GT",
+    [OP_GTE] = "OP_GTE",
+    [OP_LT] = "OP_LT",
+    [OP_LTE] = "OP_LTE",
+    [OP_EQ] = "OP_EQ",
+    [OP_NEQ] = "OP_NEQ",
+};
+
+static void add_template(char *name, struct program *prog, void *data) {
+    struct unit *u = data;
+    if (u->size == u->cap) {
+        u->cap = u->cap ? u->cap * 2 : 16;
+        u->names = realloc(u->names, u->cap * sizeof *u->names);
+        u->programs = realloc(u->programs, u->cap * sizeof *u->programs);
+        if (!u->names || !u->programs) {
+            errx(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    u->names[u->size] = name;
+    u->programs[u->size] = prog;
+    u->size++;
+}
+
+/* write str as a C string literal, starting a new line after every newline in it */
+static void emit_string(FILE *out, const char *str, size_t l) {
+    fputc('"', out);
+    for (size_t i=0; i < l; i++) {
+        unsigned char ch = str[i];
+        switch (ch) {
+            case '\n':
+                fputs("\\n", out);
+                if (i + 1 < l) {
+                    fputs("\"\n        \"", out);
+                }
+                break;
+            case '\t': fputs("\\t", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '"': fputs("\\\"", out); break;
+            case '?':
+                /* avoid trigraphs */
+                fputs(i > 0 && str[i-1] == '?' ? "\\?" : "?", out);
+                break;
+            default:
+                if (ch < 32 || ch >= 127) {
+                    fprintf(out, "\\%03o", ch);
+                } else {
+                    fputc(ch, out);
+                }
+                break;
+        }
+    }
+    fputc('"', out);
+}
+
+/* function implementing a builtin filter, or NULL if the filter is not builtin */
+static const char *builtin_filter(const char *name) {
+    for (size_t i=0; i < sizeof builtin_filters / sizeof *builtin_filters; i++) {
+        if (strcmp(name, builtin_filters[i].name) == 0) {
+            return builtin_filters[i].function;
+        }
+    }
+
+    return NULL;
+}
+
+/* number of a filter that is not builtin among those of a function, adding it to names if it is new */
+static int user_filter(const char **names, int *n, const char *name) {
+    for (int i=0; i < *n; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+
+    names[*n] = name;
+    return (*n)++;
+}
+
+/* whether the program needs its string pool and segments at runtime, ie. whether it looks up variables */
+static int uses_variables(struct program *prog) {
+    for (int pc=0; pc < prog->size; pc++) {
+        enum opcode op = prog->code[pc].op;
+        if (op == OP_LOAD || op == OP_LOAD_LOCAL || op == OP_FOR_BEGIN || op == OP_FOR_RANGE) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void emit_program(FILE *out, int id, struct program *prog) {
+    fprintf(out, "static char strings_%d[] = ", id);
+    emit_string(out, prog->strings, prog->strings_size);
+    fprintf(out, ";\n\n");
+
+    if (prog->segments_size > 0) {
+        fprintf(out, "static struct segment segments_%d[] = {\n", id);
+        for (int i=0; i < prog->segments_size; i++) {
+            struct segment *s = &prog->segments[i];
+            fprintf(out, "    { %d, %d, %uu, %d },\n", s->name, s->length, s->hash, s->last);
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "static struct program program_%d = {\n", id);
+    fprintf(out, "    .strings = strings_%d,\n", id);
+    fprintf(out, "    .strings_size = %d,\n", prog->strings_size);
+    if (prog->segments_size > 0) {
+        fprintf(out, "    .segments = segments_%d,\n", id);
+        fprintf(out, "    .segments_size = %d,\n", prog->segments_size);
+    }
+    fprintf(out, "};\n\n");
+}
+
+static void emit_function(FILE *out, int id, char *name, struct program *prog) {
+    struct instr *code = prog->code;
+    char *strings = prog->strings;
+
+    /* jump targets get a label, stack slots a local variable and filters that are not builtin one as well */
+    char *targets = calloc(prog->size + 1, 1);
+    const char **filters = malloc((prog->size + 1) * sizeof *filters);
+    int nfilters = 0;
+    if (!targets || !filters) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+    int depth = 0;
+    int max_depth = 0;
+    for (int pc=0; pc < prog->size; pc++) {
+        struct instr *ins = &code[pc];
+        switch (ins->op) {
+            case OP_PUSH_INT:
+            case OP_PUSH_STRING:
+            case OP_LOAD:
+            case OP_LOAD_LOCAL:
+            case OP_LOOP_FIELD:
+                depth++;
+                break;
+            case OP_PRINT:
+                depth--;
+                break;
+            case OP_FILTER:
+                depth -= ins->c;
+                if (builtin_filter(strings + ins->a) == NULL) {
+                    user_filter(filters, &nfilters, strings + ins->a);
+                }
+                break;
+            case OP_JMP:
+                targets[ins->a] = 1;
+                break;
+            case OP_JMP_FALSE:
+                targets[ins->a] = 1;
+                depth--;
+                break;
+            case OP_FOR_BEGIN:
+                targets[ins->c] = 1;
+                break;
+            case OP_FOR_RANGE:
+                targets[ins->c] = 1;
+                depth--;
+                break;
+            case OP_FOR_NEXT:
+                targets[ins->a] = 1;
+                break;
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_GT: case OP_GTE: case OP_LT: case OP_LTE: case OP_EQ: case OP_NEQ:
+                depth--;
+                break;
+            default:
+                break;
+        }
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+
+    enum value_type *types = malloc((max_depth + 1) * sizeof *types);
+    if (!types) {
+        errx(EXIT_FAILURE, "out of memory");
+    }
+
+    fprintf(out, "/* %s */\n", name);
+    fprintf(out, "static void render_%d(struct compiled_render *r) {\n", id);
+    if (max_depth > 0) {
+        fprintf(out, "    struct unja_object s0");
+        for (int i=1; i < max_depth; i++) {
+            fprintf(out, ", s%d", i);
+        }
+        fprintf(out, ";\n");
+    }
+    for (int i=0; i < nfilters; i++) {
+        fprintf(out, "    const struct unja_filter *f%d = compiled_find_filter(r, \"%s\");\n", i, filters[i]);
+    }
+    if (max_depth > 0 || nfilters > 0) {
+        fprintf(out, "\n");
+    }
+
+    /* s<sp - 1> is the top of the stack */
+    int sp = 0;
+    for (int pc=0; pc < prog->size; pc++) {
+        struct instr *ins = &code[pc];
+        if (targets[pc]) {
+            fprintf(out, "L%d:\n", pc);
+
+            /* a label needs a statement to go with */
+            if (ins->op == OP_BLOCK || ins->op == OP_HALT) {
+                fprintf(out, "    ;\n");
+            }
+        }
+
+        switch (ins->op) {
+            case OP_TEXT:
+                fprintf(out, "    compiled_text(r, ");
+                emit_string(out, strings + ins->a, ins->b);
+                fprintf(out, ", %d, %d);\n", ins->b, ins->c);
+                break;
+
+            case OP_PRINT:
+                fprintf(out, "    compiled_print(r, &s%d);\n", --sp);
+                break;
+
+            case OP_PUSH_INT:
+                types[sp] = VALUE_INT;
+                fprintf(out, "    s%d = make_int_object(%d);\n", sp++, ins->a);
+                break;
+
+            case OP_PUSH_STRING:
+                types[sp] = VALUE_STRING;
+                fprintf(out, "    s%d = make_string_view(", sp++);
+                emit_string(out, strings + ins->a, ins->b);
+                fprintf(out, ", %d);\n", ins->b);
+                break;
+
+            case OP_LOAD:
+                types[sp] = VALUE_ANY;
+                fprintf(out, "    s%d = compiled_load(r, &program_%d, %d);\n", sp++, id, ins->a);
+                break;
+
+            case OP_LOAD_LOCAL:
+                types[sp] = VALUE_ANY;
+                fprintf(out, "    s%d = compiled_load_local(r, &program_%d, %d, %d);\n", sp++, id, ins->a, ins->b);
+                break;
+
+            case OP_LOOP_FIELD:
+                types[sp] = VALUE_INT;
+                fprintf(out, "    s%d = make_int_object(compiled_loop_field(r, %d));\n", sp++, ins->a);
+                break;
+
+            case OP_FILTER: {
+                char *filter = strings + ins->a;
+                const char *function = builtin_filter(filter);
+                sp -= ins->c;
+                if (function) {
+                    fprintf(out, "    %s(compiled_arena(r), &s%d, ", function, sp - 1);
+                } else {
+                    fprintf(out, "    compiled_filter(r, \"%s\", f%d, &s%d, ", filter, user_filter(filters, &nfilters, filter), sp - 1);
+                }
+                if (ins->c == 0) {
+                    fprintf(out, "NULL, 0);\n");
+                } else {
+                    fprintf(out, "(struct unja_object[]) { ");
+                    for (int i=0; i < ins->c; i++) {
+                        fprintf(out, "%ss%d", i > 0 ? ", " : "", sp + i);
+                    }
+                    fprintf(out, " }, %d);\n", ins->c);
+                }
+                types[sp - 1] = strcmp(filter, "length") == 0 || strcmp(filter, "wordcount") == 0 ? VALUE_INT : VALUE_ANY;
+            }
+            break;
+
+            case OP_NOT:
+                if (types[sp - 1] == VALUE_INT) {
+                    fprintf(out, "    s%d = make_int_object(!s%d.integer);\n", sp - 1, sp - 1);
+                } else {
+                    fprintf(out, "    s%d = make_int_object(!object_to_int(&s%d));\n", sp - 1, sp - 1);
+                }
+                types[sp - 1] = VALUE_INT;
+                break;
+
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_GT: case OP_GTE: case OP_LT: case OP_LTE: case OP_EQ: case OP_NEQ: {
+                int l = sp - 2;
+                int r = sp - 1;
+                if (types[l] == VALUE_INT && types[r] == VALUE_INT) {
+                    fprintf(out, "    s%d = make_int_object(s%d.integer %s s%d.integer);\n", l, l, binary_operators[ins->op], r);
+                } else {
+                    fprintf(out, "    compiled_binary(r, &s%d, %s, &s%d);\n", l, opcode_names[ins->op], r);
+                    /* only adding two strings results in a string, and arithmetic on a float in a float */
+                    if (ins->op == OP_ADD) {
+                        types[l] = types[l] == VALUE_STRING && types[r] == VALUE_STRING ? VALUE_STRING : VALUE_ANY;
+                    } else if (ins->op == OP_SUB || ins->op == OP_MUL || ins->op == OP_DIV) {
+                        types[l] = VALUE_ANY;
+                    } else {
+                        types[l] = VALUE_INT;
+                    }
+                }
+                sp--;
+            }
+            break;
+
+            case OP_JMP:
+                fprintf(out, "    goto L%d;\n", ins->a);
+                break;
+
+            case OP_JMP_FALSE:
+                sp--;
+                if (types[sp] == VALUE_INT) {
+                    fprintf(out, "    if (s%d.integer <= 0) goto L%d;\n", sp, ins->a);
+                } else {
+                    fprintf(out, "    if (!object_is_truthy(&s%d)) goto L%d;\n", sp, ins->a);
+                }
+                break;
+
+            case OP_FOR_BEGIN:
+                fprintf(out, "    if (!compiled_for_begin(r, &program_%d, %d, strings_%d + %d)) goto L%d;\n", id, ins->b, id, ins->a, ins->c);
+                break;
+
+            case OP_FOR_RANGE:
+                sp--;
+                if (types[sp] == VALUE_INT) {
+                    fprintf(out, "    if (!compiled_for_range(r, s%d.integer, strings_%d + %d)) goto L%d;\n", sp, id, ins->a, ins->c);
+                } else {
+                    fprintf(out, "    if (!compiled_for_range(r, object_to_int(&s%d), strings_%d + %d)) goto L%d;\n", sp, id, ins->a, ins->c);
+                }
+                break;
+
+            case OP_FOR_NEXT:
+                fprintf(out, "    if (compiled_for_next(r)) goto L%d;\n", ins->a);
+                break;
+
+            case OP_BLOCK:
+                fprintf(out, "    /* block %s */\n", strings + ins->a);
+                break;
+
+            case OP_SET_TRIM:
+                fprintf(out, "    compiled_set_trim(r, %d);\n", ins->a);
+                break;
+
+            case OP_RTRIM:
+                fprintf(out, "    compiled_rtrim(r);\n");
+                break;
+
+            case OP_HALT:
+                if (pc + 1 < prog->size) {
+                    fprintf(out, "    return;\n");
+                }
+                break;
+        }
+    }
+
+    if (targets[prog->size]) {
+        fprintf(out, "L%d:\n    ;\n", prog->size);
+    }
+    fprintf(out, "}\n\n");
+    free(types);
+    free(filters);
+    free(targets);
+}
+
+static void sort_templates(struct unit *u) {
+    /* insertion sort, to keep names and programs together */
+    for (int i=1; i < u->size; i++) {
+        char *name = u->names[i];
+        struct program *prog = u->programs[i];
+        int j = i;
+        while (j > 0 && strcmp(u->names[j-1], name) > 0) {
+            u->names[j] = u->names[j-1];
+            u->programs[j] = u->programs[j-1];
+            j--;
+        }
+        u->names[j] = name;
+        u->programs[j] = prog;
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "usage: unja-compile [-e] [-n function] [-o file.c] directory\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    char *function = "template_compiled";
+    char *output = NULL;
+    int autoescape = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "en:o:")) != -1) {
+        switch (opt) {
+            case 'e': autoescape = 1; break;
+            case 'n': function = optarg; break;
+            case 'o': output = optarg; break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+    }
+    char *dirname = argv[optind];
+
+    struct unit u = { stdout, NULL, NULL, 0, 0 };
+    if (output && (u.out = fopen(output, "w")) == NULL) {
+        err(EXIT_FAILURE, "could not open \"%s\"", output);
+    }
+
+    struct env *env = env_new(dirname);
+    env_each_template(env, add_template, &u);
+    if (u.size == 0) {
+        errx(EXIT_FAILURE, "no templates in \"%s\"", dirname);
+    }
+    sort_templates(&u);
+
+    FILE *out = u.out;
+    fprintf(out, "/* generated by unja-compile from %s, do not edit */\n", dirname);
+    fprintf(out, "#include \"template.h\"\n#include \"program.h\"\n#include \"object.h\"\n#include \"compiled.h\"\n\n");
+    for (int i=0; i < u.size; i++) {
+        if (uses_variables(u.programs[i])) {
+            emit_program(out, i, u.programs[i]);
+        }
+        emit_function(out, i, u.names[i], u.programs[i]);
+    }
+
+    fprintf(out, "static const struct compiled_template templates[] = {\n");
+    for (int i=0; i < u.size; i++) {
+        fprintf(out, "    { ");
+        emit_string(out, u.names[i], strlen(u.names[i]));
+        fprintf(out, ", render_%d },\n", i);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "/* render a template compiled from %s, or from env (which may be NULL) if it is not one of them */\n", dirname);
+    fprintf(out, "char *%s(struct env *env, char *template_name, struct hashmap *vars) {\n", function);
+    fprintf(out, "    return compiled_render_template(templates, %d, %d, env, template_name, vars);\n", u.size, autoescape);
+    fprintf(out, "}\n");
+
+    if (fclose(out) != 0) {
+        err(EXIT_FAILURE, "could not write output");
+    }
+    env_free(env);
+    free(u.names);
+    free(u.programs);
+    return 0;
+}